@@ -0,0 +1,295 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef DB_CURSOR_H
+#define DB_CURSOR_H
+
+#include <stddef.h>
+#include <iterator>
+#include <vector>
+
+#include "storage/data/environment.h"
+#include "storage/data/row_set.h"
+#include "storage/data/single_row.h"
+#include "storage/ittiadb/query.h"
+#include "storage/ittiadb/table.h"
+
+/// Read rows from a table or query a few at a time, instead of fetching
+/// the whole result into one RowSet.
+///
+/// At most @a batch_size rows are held in memory, and the row buffers are
+/// reused for every batch, so a table of any size can be scanned in
+/// constant memory:
+///
+///     RowCursor cursor(table, 1);
+///     for (RowCursor::iterator row = cursor.begin(); row != cursor.end(); ++row) {
+///         other_table.insert(*row);
+///     }
+///     if (DB_NOERROR != cursor.error()) ...
+///
+/// The cursor can be traversed only once.
+class RowCursor
+{
+public:
+    /// Single-pass iterator over the rows of a RowCursor.
+    class iterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef storage::data::Row value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const storage::data::Row* pointer;
+        typedef const storage::data::Row& reference;
+
+        iterator() : cursor(NULL) {}
+
+        reference operator*() const { return *cursor->current; }
+        pointer operator->() const { return cursor->current; }
+        iterator& operator++() { if (!cursor->advance()) cursor = NULL; return *this; }
+
+        bool operator==(const iterator& other) const { return cursor == other.cursor; }
+        bool operator!=(const iterator& other) const { return cursor != other.cursor; }
+
+    private:
+        friend class RowCursor;
+        explicit iterator(RowCursor * cursor) : cursor(cursor) {}
+
+        RowCursor * cursor;
+    };
+
+    /// Read the rows of @a table in the order of the index it was opened on.
+    ///
+    /// The first row is taken with Table::fetch(), which starts at the first
+    /// key only while the table is still positioned where open() left it.
+    /// Open @a table just before constructing the cursor, and do not search,
+    /// fetch, or modify rows through it until the scan is finished.
+    ///
+    /// @param key_fields
+    ///  Number of leading index fields that uniquely identify a row. Each
+    ///  row is located by seeking past the key of the previous row.
+    RowCursor(storage::ittiadb::Table& table, int key_fields, size_t batch_size = 64);
+
+    /// Read the result of @a query page by page, starting each page after
+    /// the key of the last row read, for example:
+    ///
+    ///     SELECT id, data FROM storage WHERE id > ?
+    ///       ORDER BY id FETCH FIRST ? ROWS ONLY
+    ///
+    /// @param key_fields
+    ///  Number of leading result columns that uniquely identify a row. The
+    ///  last @a key_fields + 1 parameters of the query are the key to start
+    ///  after and the page size. Before begin() is called, set the key
+    ///  parameters through parameters() to a value below every row, and any
+    ///  other parameters as needed.
+    RowCursor(storage::ittiadb::Query& query, int key_fields, size_t batch_size = 64);
+
+    ~RowCursor();
+
+    /// Parameters of the query.
+    storage::data::Row& parameters() { return *query_params; }
+
+    /// Read the first batch and return an iterator to the first row.
+    iterator begin();
+
+    /// Iterator past the last row.
+    iterator end() { return iterator(); }
+
+    /// DB_NOERROR, or the error code that stopped the scan early.
+    int error() const { return rc; }
+
+    /// Number of rows read so far.
+    int64_t rows_read() const { return row_count; }
+
+private:
+    RowCursor(const RowCursor&);
+    RowCursor& operator=(const RowCursor&);
+
+    bool advance();
+    bool fill_table_batch();
+    bool fill_query_batch();
+    void set_error(db_result_t db_rc);
+
+private:
+    storage::ittiadb::Table * table;
+    storage::ittiadb::Query * query;
+    const int key_fields;
+    const size_t batch_size;
+
+    /// Reused row buffers for the table source.
+    std::vector<storage::data::SingleRow *> table_rows;
+    size_t table_pos;
+    size_t table_count;
+
+    /// Reused page for the query source.
+    storage::data::SingleRow * query_params;
+    storage::data::RowSet<> * query_rows;
+    storage::data::RowSet<>::const_iterator query_pos;
+
+    const storage::data::Row * current;
+    bool exhausted;
+    int rc;
+    int64_t row_count;
+};
+
+
+inline RowCursor::RowCursor(storage::ittiadb::Table& table, int key_fields, size_t batch_size)
+    : table(&table)
+    , query(NULL)
+    , key_fields(key_fields)
+    , batch_size(batch_size < 2 ? 2 : batch_size)
+    , table_rows()
+    , table_pos(0)
+    , table_count(0)
+    , query_params(NULL)
+    , query_rows(NULL)
+    , query_pos()
+    , current(NULL)
+    , exhausted(false)
+    , rc(DB_NOERROR)
+    , row_count(0)
+{
+    for (size_t i = 0; i < this->batch_size; ++i) {
+        table_rows.push_back(new storage::data::SingleRow(table.columns()));
+    }
+}
+
+inline RowCursor::RowCursor(storage::ittiadb::Query& query, int key_fields, size_t batch_size)
+    : table(NULL)
+    , query(&query)
+    , key_fields(key_fields)
+    , batch_size(batch_size < 1 ? 1 : batch_size)
+    , table_rows()
+    , table_pos(0)
+    , table_count(0)
+    , query_params(new storage::data::SingleRow(query.parameters()))
+    , query_rows(new storage::data::RowSet<>(query.columns()))
+    , query_pos()
+    , current(NULL)
+    , exhausted(false)
+    , rc(DB_NOERROR)
+    , row_count(0)
+{
+}
+
+inline RowCursor::~RowCursor()
+{
+    for (size_t i = 0; i < table_rows.size(); ++i) {
+        delete table_rows[i];
+    }
+    delete query_params;
+    delete query_rows;
+}
+
+inline RowCursor::iterator RowCursor::begin()
+{
+    return advance() ? iterator(this) : iterator();
+}
+
+inline void RowCursor::set_error(db_result_t db_rc)
+{
+    if (DB_OK != db_rc && !storage::data::Environment::is_error(DB_ENOTFOUND)) {
+        rc = storage::data::Environment::error().code;
+    }
+}
+
+inline bool RowCursor::fill_table_batch()
+{
+    table_pos = 0;
+    table_count = 0;
+    for (size_t i = 0; i < batch_size; ++i) {
+        db_result_t db_rc;
+        if (row_count == 0 && i == 0) {
+            // Freshly opened table (see the constructor): fetch the
+            // first row in index order.
+            db_rc = table->fetch(*table_rows[0]);
+        }
+        else {
+            // The previous row is in the preceding buffer, wrapping around
+            // to the last buffer of the previous batch.
+            const storage::data::Row& previous = *table_rows[(i + batch_size - 1) % batch_size];
+            db_rc = table->search_by_index(DB_SEEK_GREATER, previous, key_fields, *table_rows[i]);
+        }
+        if (DB_OK != db_rc) {
+            set_error(db_rc);
+            exhausted = true;
+            break;
+        }
+        ++table_count;
+    }
+    return table_count > 0;
+}
+
+inline bool RowCursor::fill_query_batch()
+{
+    const int page_param = (int)query_params->size() - 1;
+    (*query_params)[page_param].set((int64_t)batch_size);
+
+    query_rows->clear();
+    db_result_t db_rc = query->execute_with(*query_params, *query_rows);
+    if (DB_OK != db_rc) {
+        set_error(db_rc);
+        exhausted = true;
+        return false;
+    }
+    if (query_rows->size() < batch_size) {
+        // Short page: this is the last one.
+        exhausted = true;
+    }
+    else {
+        // The next page starts after the key of the last row, so the query
+        // can seek to it instead of skipping over every row already read.
+        const storage::data::Row& last = (*query_rows)[query_rows->size() - 1];
+        for (int i = 0; i < key_fields; ++i) {
+            (*query_params)[page_param - key_fields + i].set(last.at(i));
+        }
+    }
+    query_pos = query_rows->begin();
+    return query_pos != query_rows->end();
+}
+
+inline bool RowCursor::advance()
+{
+    current = NULL;
+    if (table != NULL) {
+        if (table_pos + 1 < table_count) {
+            ++table_pos;
+        }
+        else if (exhausted || !fill_table_batch()) {
+            return false;
+        }
+        current = table_rows[table_pos];
+    }
+    else {
+        if (row_count > 0 && ++query_pos != query_rows->end()) {
+            // Next row of the current page.
+        }
+        else if (exhausted || !fill_query_batch()) {
+            return false;
+        }
+        current = &*query_pos;
+    }
+    ++row_count;
+    return true;
+}
+
+#endif
@@ -23,14 +23,139 @@
 
 #include "storage/data/environment.h"
 #include <iostream>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "example_thread_pool.h"
 
 int example_main(int argc, char* argv[]);
 
+/// Parse a harness option of the form "<name><positive integer>".
+static bool parse_harness_option(const char * arg, const char * name, int& value)
+{
+    const size_t name_len = strlen(name);
+    if (0 != strncmp(arg, name, name_len)) {
+        return false;
+    }
+    value = atoi(arg + name_len);
+    if (value < 1) {
+        value = 1;
+    }
+    return true;
+}
+
+/// Run example_main @a runs times across @a threads worker threads and
+/// report throughput.
+///
+/// Each occurrence of "%n" in the example arguments is replaced by the run
+/// number, so that concurrent runs can be given separate database files.
+/// Without "%n" every run would use the same database file, so the runs
+/// are made one at a time regardless of @a threads.
+static int run_harness(int runs, int threads, int argc, char* argv[])
+{
+    bool per_run_arguments = false;
+    for (int i = 1; i < argc; ++i) {
+        if (NULL != strstr(argv[i], "%n")) {
+            per_run_arguments = true;
+        }
+    }
+    if (threads > 1 && !per_run_arguments) {
+        std::cout << "No %n in the example arguments: runs would share one database, using 1 thread" << std::endl;
+        threads = 1;
+    }
+
+    // Interactive SQL shells would compete for console input; make them
+    // return immediately instead. The previous state is restored afterwards.
+    const std::ios::iostate cin_state = std::cin.rdstate();
+    std::cin.setstate(std::ios::eofbit);
+
+    std::vector<std::vector<std::string> > run_args(runs);
+    std::vector<std::vector<char*> > run_argv(runs);
+    for (int run = 0; run < runs; ++run) {
+        char run_number[16];
+        sprintf(run_number, "%d", run);
+        for (int i = 0; i < argc; ++i) {
+            std::string arg(argv[i]);
+            for (size_t pos = arg.find("%n"); pos != std::string::npos; pos = arg.find("%n", pos)) {
+                arg.replace(pos, 2, run_number);
+                pos += strlen(run_number);
+            }
+            run_args[run].push_back(arg);
+        }
+        for (int i = 0; i < argc; ++i) {
+            run_argv[run].push_back(&run_args[run][i][0]);
+        }
+        run_argv[run].push_back(NULL);
+    }
+
+    std::cout << "Running example " << runs << " times on " << threads << " threads" << std::endl;
+
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::vector<std::future<int> > results;
+    {
+        example_thread_pool workers(threads);
+        for (int run = 0; run < runs; ++run) {
+            std::vector<char*> * example_argv = &run_argv[run];
+            results.push_back(workers.submit([argc, example_argv](storage::ittiadb::Connection&) {
+                return example_main(argc, &(*example_argv)[0]);
+            }));
+        }
+        // Destroying the pool waits for all runs to finish.
+    }
+    const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - started;
+    std::cin.clear(cin_state);
+
+    int failed = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (EXIT_SUCCESS != results[i].get()) {
+            ++failed;
+        }
+    }
+
+    const long long elapsed_ms = (long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    std::cout << "Harness finished " << runs << " runs on " << threads << " threads in "
+        << elapsed_ms << " milliseconds ("
+        << (elapsed_ms > 0 ? runs * 1000.0 / elapsed_ms : 0.0) << " runs/second), "
+        << failed << " failed" << std::endl;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/// Initialize ITTIA DB SQL and run the example.
+///
+/// Optional leading arguments turn any example into a concurrency and
+/// resource leak test, for example:
+///
+///     example --repeat=100 --threads=8 run_%n.ittiadb
+///
+/// --repeat=N runs the example N times and --threads=M spreads the runs
+/// across M threads. These options are removed before the remaining
+/// arguments are passed to example_main. Only examples that take their
+/// database name from the command line and keep no state of their own
+/// between runs are safe to run on more than one thread.
 int db_main(int argc, char* argv[])
 {
     int exit_code;
     int status;
+    int harness_runs = 1;
+    int harness_threads = 1;
+
+    // Strip harness options, keeping the program name.
+    std::vector<char*> example_argv(argv, argv + argc);
+    while (example_argv.size() > 1
+           && (parse_harness_option(example_argv[1], "--repeat=", harness_runs)
+               || parse_harness_option(example_argv[1], "--threads=", harness_threads)))
+    {
+        example_argv.erase(example_argv.begin() + 1);
+    }
+    const int example_argc = (int)example_argv.size();
+    const bool use_harness = harness_runs > 1 || harness_threads > 1;
+    example_argv.push_back(NULL);
 
     /* Initialize ITTIA DB SQL library. */
     status = storage::data::Environment::init();
@@ -39,14 +164,23 @@ int db_main(int argc, char* argv[])
         db_api_statistics_t api_stats;
         db_lm_statistics_t lm_stats;
 
+        bool collect_statistics = use_harness;
 #ifdef _DEBUG
-        /* Enable collection of statistics. */
-        storage::data::Environment::get_api_statistics(NULL, DB_STATISTICS_ENABLE);
-        storage::data::Environment::get_lm_statistics(NULL, DB_STATISTICS_ENABLE);
+        collect_statistics = true;
 #endif
+        if (collect_statistics) {
+            /* Enable collection of statistics. */
+            storage::data::Environment::get_api_statistics(NULL, DB_STATISTICS_ENABLE);
+            storage::data::Environment::get_lm_statistics(NULL, DB_STATISTICS_ENABLE);
+        }
 
         /* Run the example application. */
-        exit_code = example_main(argc, argv);
+        if (use_harness) {
+            exit_code = run_harness(harness_runs, harness_threads, example_argc, &example_argv[0]);
+        }
+        else {
+            exit_code = example_main(example_argc, &example_argv[0]);
+        }
 
         /* Release all resources owned by the ITTIA DB SQL library. */
         status = storage::data::Environment::done(NULL, &api_stats, &lm_stats);
@@ -0,0 +1,126 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef DB_SEQUENCE_H
+#define DB_SEQUENCE_H
+
+#include <string>
+
+#include "storage/data/environment.h"
+#include "storage/ittiadb/connection.h"
+#include "storage/ittiadb/sequence.h"
+
+/// Hand out sequence values from blocks reserved in the database.
+///
+/// The sequence must be created with an increment equal to the block size:
+///
+///     CREATE SEQUENCE age_seq START WITH 1 INCREMENT BY 64
+///
+/// Each database call to get the next value then reserves a whole block of
+/// 64 values, which are returned by next_value() without touching the
+/// database. Values stay unique across connections and increase within one
+/// allocator, but values left in a block are skipped when the allocator is
+/// destroyed.
+///
+/// Because the value is known before a row is inserted, a generated key
+/// does not have to be read back with "SELECT CURRENT VALUE FOR ..." after
+/// the insert.
+///
+/// A SequenceBlockAllocator is not thread-safe; use one per connection.
+class SequenceBlockAllocator
+{
+public:
+    /// @param block_size
+    ///  Values reserved per database call; must match the sequence's
+    ///  INCREMENT BY clause.
+    SequenceBlockAllocator(storage::ittiadb::Connection& database, const char * sequence_name, int64_t block_size);
+
+    /// Get the next value, reserving a new block first if the current one
+    /// is used up. Returns DB_NOERROR or the error code of the reservation.
+    int next_value(int64_t& value);
+
+    /// Forget the rest of the current block, e.g. after the sequence was
+    /// dropped and created again.
+    void reset() { next = end = 0; }
+
+    /// Number of blocks reserved from the database.
+    int64_t blocks_reserved() const { return blocks; }
+
+private:
+    SequenceBlockAllocator(const SequenceBlockAllocator&);
+    SequenceBlockAllocator& operator=(const SequenceBlockAllocator&);
+
+    int reserve_block();
+
+private:
+    storage::ittiadb::Connection& db;
+    const std::string sequence_name;
+    const int64_t block_size;
+    int64_t next;
+    int64_t end;
+    int64_t blocks;
+};
+
+
+inline SequenceBlockAllocator::SequenceBlockAllocator(storage::ittiadb::Connection& database,
+                                                      const char * sequence_name, int64_t block_size)
+    : db(database)
+    , sequence_name(sequence_name)
+    , block_size(block_size < 1 ? 1 : block_size)
+    , next(0)
+    , end(0)
+    , blocks(0)
+{
+}
+
+inline int SequenceBlockAllocator::next_value(int64_t& value)
+{
+    if (next == end) {
+        int rc = reserve_block();
+        if (DB_NOERROR != rc) {
+            return rc;
+        }
+    }
+    value = next++;
+    return DB_NOERROR;
+}
+
+inline int SequenceBlockAllocator::reserve_block()
+{
+    // The sequence is only opened once per block, so no handle is left
+    // open that would prevent it from being dropped.
+    storage::ittiadb::Sequence sequence(db, sequence_name.c_str());
+    db_seqvalue_t first;
+
+    if (DB_OK != sequence.open() || DB_OK != sequence.get_next_value(first)) {
+        return storage::data::Environment::error().code;
+    }
+    (void)sequence.close();
+
+    next = first.int64;
+    end = first.int64 + block_size;
+    ++blocks;
+    return DB_NOERROR;
+}
+
+#endif
@@ -0,0 +1,535 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef EXAMPLE_CACHE_POLICY_H
+#define EXAMPLE_CACHE_POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Replacement policy for one tier of a cache of string keys.
+///
+/// The policy only tracks keys; the caller keeps the cached rows and
+/// removes the rows of the keys the policy hands back as victims:
+///
+///     std::vector<std::string> victims;
+///     if (policy.admit(key)) {
+///         policy.on_insert(key, victims);
+///         // delete rows of victims, insert row of key
+///     }
+///
+/// Policies are not thread-safe.
+class example_cache_policy
+{
+public:
+    virtual ~example_cache_policy() {}
+
+    /// Short name for reports, e.g. "arc".
+    virtual std::string name() const = 0;
+
+    /// Maximum number of resident keys.
+    virtual size_t capacity() const = 0;
+
+    /// Number of resident keys.
+    virtual size_t size() const = 0;
+
+    /// A resident @a key was read.
+    virtual void on_hit(const std::string& key) = 0;
+
+    /// Decide whether @a key, which missed this tier, should be brought
+    /// in. The default admits every key.
+    virtual bool admit(const std::string& key) { (void)key; return true; }
+
+    /// Make @a key resident. Keys that must leave the tier to make room
+    /// are appended to @a victims.
+    virtual void on_insert(const std::string& key, std::vector<std::string>& victims) = 0;
+
+    /// @a key left the tier for another reason, e.g. a failed insert.
+    virtual void on_remove(const std::string& key) = 0;
+
+    /// Key that would be evicted by the next insert of a new key. Returns
+    /// false if the tier has room.
+    virtual bool victim(std::string& key) const = 0;
+};
+
+/// Least recently used.
+class example_lru_policy : public example_cache_policy
+{
+public:
+    explicit example_lru_policy(size_t capacity) : max_size(capacity < 1 ? 1 : capacity) {}
+
+    std::string name() const { return "lru"; }
+    size_t capacity() const { return max_size; }
+    size_t size() const { return index.size(); }
+    void on_hit(const std::string& key);
+    void on_insert(const std::string& key, std::vector<std::string>& victims);
+    void on_remove(const std::string& key);
+    bool victim(std::string& key) const;
+
+private:
+    typedef std::list<std::string> key_list_t;
+
+    const size_t max_size;
+    key_list_t order;   ///< Most recent first
+    std::unordered_map<std::string, key_list_t::iterator> index;
+};
+
+/// 2Q: new keys wait in a small FIFO (A1in) and are remembered for a while
+/// after they leave it (A1out). Only keys seen again while remembered enter
+/// the main LRU list (Am), so a scan of keys read once can't flush the
+/// keys that are read often.
+class example_2q_policy : public example_cache_policy
+{
+public:
+    explicit example_2q_policy(size_t capacity);
+
+    std::string name() const { return "2q"; }
+    size_t capacity() const { return max_size; }
+    size_t size() const { return a1in.size() + am.size(); }
+    void on_hit(const std::string& key);
+    void on_insert(const std::string& key, std::vector<std::string>& victims);
+    void on_remove(const std::string& key);
+    bool victim(std::string& key) const;
+
+private:
+    typedef std::list<std::string> key_list_t;
+    enum queue_t { A1IN, AM, A1OUT };
+    struct entry_t {
+        queue_t queue;
+        key_list_t::iterator pos;
+    };
+
+    key_list_t& list_of(queue_t queue) { return A1IN == queue ? a1in : AM == queue ? am : a1out; }
+    void erase(const std::string& key);
+
+    const size_t max_size;
+    const size_t kin;   ///< Target size of A1in
+    const size_t kout;  ///< Size of A1out
+    key_list_t a1in;    ///< Resident, seen once; newest first
+    key_list_t am;      ///< Resident, seen again; most recent first
+    key_list_t a1out;   ///< Not resident, recently left A1in; newest first
+    std::unordered_map<std::string, entry_t> index;
+};
+
+/// Adaptive Replacement Cache: keys seen once (T1) and keys seen at least
+/// twice (T2) share the tier. Ghost lists of recently evicted keys (B1, B2)
+/// move the target size of T1 towards whichever list would have had the
+/// hit, adapting between recency and frequency.
+class example_arc_policy : public example_cache_policy
+{
+public:
+    explicit example_arc_policy(size_t capacity) : max_size(capacity < 1 ? 1 : capacity), p(0) {}
+
+    std::string name() const { return "arc"; }
+    size_t capacity() const { return max_size; }
+    size_t size() const { return t1.size() + t2.size(); }
+    void on_hit(const std::string& key);
+    void on_insert(const std::string& key, std::vector<std::string>& victims);
+    void on_remove(const std::string& key);
+    bool victim(std::string& key) const;
+
+private:
+    typedef std::list<std::string> key_list_t;
+    enum queue_t { T1, T2, B1, B2 };
+    struct entry_t {
+        queue_t queue;
+        key_list_t::iterator pos;
+    };
+
+    key_list_t& list_of(queue_t queue) { return T1 == queue ? t1 : T2 == queue ? t2 : B1 == queue ? b1 : b2; }
+    void move_to_front(const std::string& key, queue_t queue);
+    void drop_lru(queue_t queue);
+    bool evict_from_t1(bool hit_in_b2) const;
+    void replace(bool hit_in_b2, std::vector<std::string>& victims);
+
+    const size_t max_size;
+    size_t p;           ///< Target size of T1
+    key_list_t t1, t2;  ///< Resident; most recent first
+    key_list_t b1, b2;  ///< Ghosts of keys evicted from T1 and T2
+    std::unordered_map<std::string, entry_t> index;
+};
+
+/// TinyLFU admission in front of another policy.
+///
+/// Access frequencies of all keys, resident or not, are estimated with a
+/// count-min sketch of 4-bit counters that are halved periodically, so old
+/// popularity fades. A key that missed is admitted only if it is estimated
+/// to be more popular than the key it would evict, which keeps one-hit
+/// keys of a long tail out of a full tier.
+class example_tinylfu_policy : public example_cache_policy
+{
+public:
+    /// Take ownership of @a eviction, which picks the victims.
+    explicit example_tinylfu_policy(example_cache_policy * eviction);
+
+    std::string name() const { return main->name() + "+tinylfu"; }
+    size_t capacity() const { return main->capacity(); }
+    size_t size() const { return main->size(); }
+    void on_hit(const std::string& key) { record(key); main->on_hit(key); }
+    bool admit(const std::string& key);
+    void on_insert(const std::string& key, std::vector<std::string>& victims) { main->on_insert(key, victims); }
+    void on_remove(const std::string& key) { main->on_remove(key); }
+    bool victim(std::string& key) const { return main->victim(key); }
+
+private:
+    static const int DEPTH = 4;
+    static const uint8_t MAX_COUNT = 15;
+
+    void record(const std::string& key);
+    int estimate(const std::string& key) const;
+    size_t slot(size_t hash, int row) const;
+
+    std::unique_ptr<example_cache_policy> main;
+    std::vector<uint8_t> counters;  ///< DEPTH rows of width counters
+    size_t width;
+    size_t additions;
+    size_t sample_size;     ///< Counters are halved after this many additions
+};
+
+/// Create a policy by name: "lru", "2q" or "arc", optionally followed by
+/// "+tinylfu" for TinyLFU admission. "tinylfu" alone means "lru+tinylfu".
+/// Returns NULL for an unknown name.
+inline example_cache_policy * example_make_cache_policy(const std::string& name, size_t capacity)
+{
+    const std::string suffix = "+tinylfu";
+    if ("tinylfu" == name) {
+        return new example_tinylfu_policy(new example_lru_policy(capacity));
+    }
+    if (name.size() > suffix.size() && 0 == name.compare(name.size() - suffix.size(), suffix.size(), suffix)) {
+        example_cache_policy * eviction = example_make_cache_policy(name.substr(0, name.size() - suffix.size()), capacity);
+        return NULL == eviction ? NULL : new example_tinylfu_policy(eviction);
+    }
+    if ("lru" == name) {
+        return new example_lru_policy(capacity);
+    }
+    if ("2q" == name) {
+        return new example_2q_policy(capacity);
+    }
+    if ("arc" == name) {
+        return new example_arc_policy(capacity);
+    }
+    return NULL;
+}
+
+
+inline void example_lru_policy::on_hit(const std::string& key)
+{
+    std::unordered_map<std::string, key_list_t::iterator>::iterator it = index.find(key);
+    if (it != index.end()) {
+        order.splice(order.begin(), order, it->second);
+    }
+}
+
+inline void example_lru_policy::on_insert(const std::string& key, std::vector<std::string>& victims)
+{
+    if (index.count(key)) {
+        on_hit(key);
+        return;
+    }
+    order.push_front(key);
+    index[key] = order.begin();
+    while (index.size() > max_size) {
+        victims.push_back(order.back());
+        index.erase(order.back());
+        order.pop_back();
+    }
+}
+
+inline void example_lru_policy::on_remove(const std::string& key)
+{
+    std::unordered_map<std::string, key_list_t::iterator>::iterator it = index.find(key);
+    if (it != index.end()) {
+        order.erase(it->second);
+        index.erase(it);
+    }
+}
+
+inline bool example_lru_policy::victim(std::string& key) const
+{
+    if (index.size() < max_size) {
+        return false;
+    }
+    key = order.back();
+    return true;
+}
+
+
+inline example_2q_policy::example_2q_policy(size_t capacity)
+    : max_size(capacity < 1 ? 1 : capacity)
+    // Sizes recommended by the 2Q paper
+    , kin(max_size / 4 < 1 ? 1 : max_size / 4)
+    , kout(max_size / 2 < 1 ? 1 : max_size / 2)
+{
+}
+
+inline void example_2q_policy::erase(const std::string& key)
+{
+    std::unordered_map<std::string, entry_t>::iterator it = index.find(key);
+    if (it != index.end()) {
+        list_of(it->second.queue).erase(it->second.pos);
+        index.erase(it);
+    }
+}
+
+inline void example_2q_policy::on_hit(const std::string& key)
+{
+    std::unordered_map<std::string, entry_t>::iterator it = index.find(key);
+    // Hits in A1in are not counted: they are usually correlated references
+    // shortly after the first one.
+    if (it != index.end() && AM == it->second.queue) {
+        am.splice(am.begin(), am, it->second.pos);
+    }
+}
+
+inline void example_2q_policy::on_insert(const std::string& key, std::vector<std::string>& victims)
+{
+    std::unordered_map<std::string, entry_t>::iterator it = index.find(key);
+    if (it != index.end() && A1OUT != it->second.queue) {
+        on_hit(key);
+        return;
+    }
+
+    if (it != index.end()) {
+        // Seen again soon after it left A1in
+        a1out.erase(it->second.pos);
+        am.push_front(key);
+        it->second.queue = AM;
+        it->second.pos = am.begin();
+    }
+    else {
+        a1in.push_front(key);
+        entry_t entry = { A1IN, a1in.begin() };
+        index[key] = entry;
+    }
+
+    while (size() > max_size) {
+        if (a1in.size() > kin || am.empty()) {
+            // Remember the key, but not its row
+            std::string old = a1in.back();
+            a1in.pop_back();
+            victims.push_back(old);
+            a1out.push_front(old);
+            index[old].queue = A1OUT;
+            index[old].pos = a1out.begin();
+            if (a1out.size() > kout) {
+                index.erase(a1out.back());
+                a1out.pop_back();
+            }
+        }
+        else {
+            victims.push_back(am.back());
+            index.erase(am.back());
+            am.pop_back();
+        }
+    }
+}
+
+inline void example_2q_policy::on_remove(const std::string& key)
+{
+    std::unordered_map<std::string, entry_t>::iterator it = index.find(key);
+    if (it != index.end() && A1OUT != it->second.queue) {
+        erase(key);
+    }
+}
+
+inline bool example_2q_policy::victim(std::string& key) const
+{
+    if (size() < max_size) {
+        return false;
+    }
+    key = (a1in.size() >= kin || am.empty()) ? a1in.back() : am.back();
+    return true;
+}
+
+
+inline void example_arc_policy::move_to_front(const std::string& key, queue_t queue)
+{
+    entry_t& entry = index[key];
+    key_list_t& to = list_of(queue);
+    to.splice(to.begin(), list_of(entry.queue), entry.pos);
+    entry.queue = queue;
+    entry.pos = to.begin();
+}
+
+inline void example_arc_policy::drop_lru(queue_t queue)
+{
+    key_list_t& from = list_of(queue);
+    index.erase(from.back());
+    from.pop_back();
+}
+
+inline bool example_arc_policy::evict_from_t1(bool hit_in_b2) const
+{
+    return !t1.empty() && (t1.size() > p || (hit_in_b2 && t1.size() == p) || t2.empty());
+}
+
+inline void example_arc_policy::replace(bool hit_in_b2, std::vector<std::string>& victims)
+{
+    if (size() < max_size) {
+        return;
+    }
+    // Evicted keys become ghosts
+    const queue_t from = evict_from_t1(hit_in_b2) ? T1 : T2;
+    const std::string key = list_of(from).back();
+    victims.push_back(key);
+    move_to_front(key, T1 == from ? B1 : B2);
+}
+
+inline void example_arc_policy::on_hit(const std::string& key)
+{
+    std::unordered_map<std::string, entry_t>::iterator it = index.find(key);
+    if (it != index.end() && (T1 == it->second.queue || T2 == it->second.queue)) {
+        move_to_front(key, T2);
+    }
+}
+
+inline void example_arc_policy::on_insert(const std::string& key, std::vector<std::string>& victims)
+{
+    std::unordered_map<std::string, entry_t>::iterator it = index.find(key);
+    if (it != index.end() && B1 == it->second.queue) {
+        // Would have been a hit with a larger T1
+        const size_t delta = b2.size() > b1.size() ? b2.size() / b1.size() : 1;
+        p = p + delta > max_size ? max_size : p + delta;
+        replace(false, victims);
+        move_to_front(key, T2);
+    }
+    else if (it != index.end() && B2 == it->second.queue) {
+        // Would have been a hit with a larger T2
+        const size_t delta = b1.size() > b2.size() ? b1.size() / b2.size() : 1;
+        p = delta > p ? 0 : p - delta;
+        replace(true, victims);
+        move_to_front(key, T2);
+    }
+    else if (it != index.end()) {
+        on_hit(key);
+    }
+    else {
+        const size_t l1 = t1.size() + b1.size();
+        const size_t total = l1 + t2.size() + b2.size();
+        if (l1 >= max_size) {
+            if (t1.size() < max_size) {
+                drop_lru(B1);
+                replace(false, victims);
+            }
+            else {
+                // B1 is empty and T1 fills the tier
+                victims.push_back(t1.back());
+                drop_lru(T1);
+            }
+        }
+        else if (total >= max_size) {
+            if (total >= 2 * max_size) {
+                drop_lru(B2);
+            }
+            replace(false, victims);
+        }
+        t1.push_front(key);
+        entry_t entry = { T1, t1.begin() };
+        index[key] = entry;
+    }
+}
+
+inline void example_arc_policy::on_remove(const std::string& key)
+{
+    std::unordered_map<std::string, entry_t>::iterator it = index.find(key);
+    if (it != index.end() && (T1 == it->second.queue || T2 == it->second.queue)) {
+        list_of(it->second.queue).erase(it->second.pos);
+        index.erase(it);
+    }
+}
+
+inline bool example_arc_policy::victim(std::string& key) const
+{
+    if (size() < max_size) {
+        return false;
+    }
+    key = evict_from_t1(false) ? t1.back() : t2.back();
+    return true;
+}
+
+
+inline example_tinylfu_policy::example_tinylfu_policy(example_cache_policy * eviction)
+    : main(eviction)
+    , counters()
+    , width(16)
+    , additions(0)
+    , sample_size(0)
+{
+    // About 8 counters per resident key
+    while (width < eviction->capacity() * 8) {
+        width <<= 1;
+    }
+    counters.assign(width * DEPTH, 0);
+    sample_size = eviction->capacity() * 10;
+}
+
+inline size_t example_tinylfu_policy::slot(size_t hash, int row) const
+{
+    // Derive the row hashes from two halves of one hash
+    const size_t h2 = (hash >> 16) | 1;
+    return (size_t)row * width + ((hash + (size_t)row * h2) & (width - 1));
+}
+
+inline void example_tinylfu_policy::record(const std::string& key)
+{
+    const size_t hash = std::hash<std::string>()(key);
+    for (int row = 0; row < DEPTH; ++row) {
+        uint8_t& counter = counters[slot(hash, row)];
+        if (counter < MAX_COUNT) {
+            ++counter;
+        }
+    }
+    if (++additions >= sample_size) {
+        // Age all counts so the sketch follows changes in popularity
+        for (size_t i = 0; i < counters.size(); ++i) {
+            counters[i] >>= 1;
+        }
+        additions /= 2;
+    }
+}
+
+inline int example_tinylfu_policy::estimate(const std::string& key) const
+{
+    const size_t hash = std::hash<std::string>()(key);
+    int count = MAX_COUNT;
+    for (int row = 0; row < DEPTH; ++row) {
+        const int counter = counters[slot(hash, row)];
+        count = counter < count ? counter : count;
+    }
+    return count;
+}
+
+inline bool example_tinylfu_policy::admit(const std::string& key)
+{
+    record(key);
+    std::string old;
+    return !main->victim(old) || estimate(key) > estimate(old);
+}
+
+#endif
@@ -0,0 +1,502 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef EXAMPLE_CONNECTION_POOL_H
+#define EXAMPLE_CONNECTION_POOL_H
+
+#include <stddef.h>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "storage/data/environment.h"
+#include "storage/ittiadb/connection.h"
+#include "storage/ittiadb/query.h"
+#include "storage/ittiadb/table.h"
+#include "storage/ittiadb/transaction.h"
+#include "db_iostream.h"
+
+/// Thread-safe pool of open connections to one database.
+///
+/// Opening a connection and its tables is expensive compared to a short
+/// transaction, so connections are returned to the pool instead of being
+/// closed, together with any tables opened through them in shared mode and
+/// any statements prepared on them.
+class example_connection_pool
+{
+public:
+    /// A connection owned by the pool, with a cache of open tables and
+    /// prepared statements.
+    class pooled_connection
+    {
+    public:
+        /// The underlying database connection.
+        storage::ittiadb::Connection& connection() { return db; }
+
+        /// Return table @a table_name opened on @a index_name, opening it
+        /// the first time it is requested on this connection. Returns NULL
+        /// if the table cannot be opened.
+        ///
+        /// Shared tables stay open while the connection is idle in the pool.
+        /// Exclusive tables are closed when the connection is released, so
+        /// an idle connection never locks other connections out.
+        storage::ittiadb::Table * table(const char * table_name,
+                                        const char * index_name = NULL,
+                                        storage::ittiadb::Table::LockMode lock_mode = storage::ittiadb::Table::Shared);
+
+        /// Return statement @a sql prepared on this connection, preparing it
+        /// the first time it is requested. Returns NULL if the statement
+        /// cannot be prepared.
+        storage::ittiadb::Query * query(const char * sql);
+
+    private:
+        friend class example_connection_pool;
+
+        explicit pooled_connection(const char * database_uri);
+        ~pooled_connection();
+        pooled_connection(const pooled_connection&);
+        pooled_connection& operator=(const pooled_connection&);
+
+        void close_tables();
+        void close_exclusive_tables();
+        void close_queries();
+
+        typedef std::map<std::string, storage::ittiadb::Table *> table_map_t;
+        typedef std::map<std::string, storage::ittiadb::Query *> query_map_t;
+
+        storage::ittiadb::Connection db;
+        table_map_t tables;
+        query_map_t queries;
+        std::chrono::steady_clock::time_point released_at;
+    };
+
+    /// Borrow a connection from a pool for the lifetime of this object.
+    class lease
+    {
+    public:
+        /// Acquire a connection, waiting up to @a timeout_milliseconds
+        /// (or forever if negative).
+        explicit lease(example_connection_pool& pool, int32_t timeout_milliseconds = -1)
+            : pool(pool)
+            , conn(pool.acquire(timeout_milliseconds))
+        {
+        }
+
+        /// Return the connection to the pool.
+        ~lease() { if (conn != NULL) pool.release(conn); }
+
+        /// Check whether a connection was acquired.
+        bool valid() const { return conn != NULL; }
+
+        /// The borrowed connection.
+        storage::ittiadb::Connection& connection() { return conn->connection(); }
+
+        /// Open table cached by the borrowed connection. @sa pooled_connection::table
+        storage::ittiadb::Table * table(const char * table_name,
+                                        const char * index_name = NULL,
+                                        storage::ittiadb::Table::LockMode lock_mode = storage::ittiadb::Table::Shared)
+        {
+            return conn->table(table_name, index_name, lock_mode);
+        }
+
+        /// Statement cached by the borrowed connection. @sa pooled_connection::query
+        storage::ittiadb::Query * query(const char * sql) { return conn->query(sql); }
+
+    private:
+        lease(const lease&);
+        lease& operator=(const lease&);
+
+        example_connection_pool& pool;
+        pooled_connection * conn;
+    };
+
+    /// Pool usage counters.
+    struct statistics_t {
+        /// Connections handed out by acquire().
+        uint64_t acquired;
+        /// Connections opened by the pool.
+        uint64_t opened;
+        /// Connections closed because the health check failed.
+        uint64_t discarded;
+        /// Transactions rolled back because a connection was released with
+        /// the transaction still active.
+        uint64_t rollbacks;
+        /// Calls to acquire() that had to wait for a connection.
+        uint64_t waits;
+        /// Calls to acquire() that timed out.
+        uint64_t timeouts;
+        /// Total and longest time spent waiting in acquire().
+        uint64_t total_wait_microseconds;
+        uint64_t max_wait_microseconds;
+        /// Connections currently idle and currently borrowed.
+        size_t idle;
+        size_t in_use;
+    };
+
+    /// Create a pool of connections to the existing database @a database_uri.
+    ///
+    /// @param min_size
+    ///  Number of connections opened immediately.
+    /// @param max_size
+    ///  Maximum number of connections open at once. acquire() waits when
+    ///  this many connections are borrowed.
+    /// @param health_check_milliseconds
+    ///  A connection that has been idle for longer than this is checked
+    ///  before it is handed out again. Zero checks every time.
+    example_connection_pool(const char * database_uri, size_t min_size, size_t max_size,
+                            int32_t health_check_milliseconds = 1000);
+
+    /// Close all connections. All leases must be released first.
+    ~example_connection_pool();
+
+    /// Borrow a connection, waiting up to @a timeout_milliseconds (or
+    /// forever if negative) when all connections are in use. Returns NULL on
+    /// timeout or if a new connection cannot be opened.
+    pooled_connection * acquire(int32_t timeout_milliseconds = -1);
+
+    /// Return a connection to the pool. An active transaction is rolled back
+    /// and tables opened in exclusive mode are closed.
+    void release(pooled_connection * conn);
+
+    /// Close all idle connections, for example before the database file is removed.
+    void close_idle();
+
+    /// Snapshot of usage counters.
+    statistics_t statistics() const;
+
+private:
+    example_connection_pool(const example_connection_pool&);
+    example_connection_pool& operator=(const example_connection_pool&);
+
+    pooled_connection * open_connection();
+    bool is_healthy(pooled_connection * conn);
+    void discard(pooled_connection * conn);
+
+private:
+    const std::string database_uri;
+    const size_t max_size;
+    const std::chrono::milliseconds health_check_interval;
+
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    std::vector<pooled_connection *> idle;
+    size_t in_use;
+    /// Connections being opened outside the lock, counted toward max_size.
+    size_t opening;
+    statistics_t stats;
+};
+
+
+inline example_connection_pool::pooled_connection::pooled_connection(const char * database_uri)
+    : db(database_uri)
+    , tables()
+    , queries()
+    , released_at(std::chrono::steady_clock::now())
+{
+}
+
+inline example_connection_pool::pooled_connection::~pooled_connection()
+{
+    close_queries();
+    close_tables();
+    (void)db.close();
+}
+
+inline void example_connection_pool::pooled_connection::close_queries()
+{
+    for (query_map_t::iterator iter = queries.begin(); iter != queries.end(); ++iter) {
+        (void)iter->second->close();
+        delete iter->second;
+    }
+    queries.clear();
+}
+
+inline void example_connection_pool::pooled_connection::close_tables()
+{
+    for (table_map_t::iterator iter = tables.begin(); iter != tables.end(); ++iter) {
+        (void)iter->second->close();
+        delete iter->second;
+    }
+    tables.clear();
+}
+
+inline void example_connection_pool::pooled_connection::close_exclusive_tables()
+{
+    table_map_t::iterator iter = tables.begin();
+    while (iter != tables.end()) {
+        if (iter->first.compare(iter->first.size() - 2, 2, "/x") == 0) {
+            (void)iter->second->close();
+            delete iter->second;
+            tables.erase(iter++);
+        }
+        else {
+            ++iter;
+        }
+    }
+}
+
+inline storage::ittiadb::Table *
+example_connection_pool::pooled_connection::table(const char * table_name, const char * index_name,
+                                                  storage::ittiadb::Table::LockMode lock_mode)
+{
+    std::string key(table_name);
+    key += '/';
+    if (index_name != NULL) {
+        key += index_name;
+    }
+    key += (lock_mode == storage::ittiadb::Table::Exclusive) ? "/x" : "/s";
+
+    table_map_t::iterator found = tables.find(key);
+    if (found != tables.end()) {
+        return found->second;
+    }
+
+    storage::ittiadb::Table * table = new storage::ittiadb::Table(db, table_name);
+    db_result_t db_rc = (index_name != NULL)
+        ? table->open(index_name, lock_mode)
+        : table->open(lock_mode);
+    if (DB_OK != db_rc) {
+        std::cerr << "Connection pool: couldn't open table " << table_name << ":"
+            << storage::data::Environment::error() << std::endl;
+        delete table;
+        return NULL;
+    }
+    tables[key] = table;
+    return table;
+}
+
+inline storage::ittiadb::Query *
+example_connection_pool::pooled_connection::query(const char * sql)
+{
+    query_map_t::iterator found = queries.find(sql);
+    if (found != queries.end()) {
+        return found->second;
+    }
+
+    storage::ittiadb::Query * query = new storage::ittiadb::Query(db, sql);
+    if (DB_OK != query->prepare()) {
+        std::cerr << "Connection pool: couldn't prepare " << sql << ":"
+            << storage::data::Environment::error() << std::endl;
+        delete query;
+        return NULL;
+    }
+    queries[sql] = query;
+    return query;
+}
+
+
+inline example_connection_pool::example_connection_pool(const char * database_uri, size_t min_size, size_t max_size,
+                                                         int32_t health_check_milliseconds)
+    : database_uri(database_uri)
+    , max_size(max_size < 1 ? 1 : max_size)
+    , health_check_interval(health_check_milliseconds)
+    , idle()
+    , in_use(0)
+    , opening(0)
+    , stats()
+{
+    for (size_t i = 0; i < min_size && i < this->max_size; ++i) {
+        pooled_connection * conn = open_connection();
+        if (conn == NULL) {
+            break;
+        }
+        idle.push_back(conn);
+    }
+}
+
+inline example_connection_pool::~example_connection_pool()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < idle.size(); ++i) {
+        delete idle[i];
+    }
+    idle.clear();
+}
+
+inline example_connection_pool::pooled_connection *
+example_connection_pool::open_connection()
+{
+    pooled_connection * conn = new pooled_connection(database_uri.c_str());
+    if (DB_OK != conn->db.open(storage::ittiadb::Connection::OpenExisting)) {
+        std::cerr << "Connection pool: couldn't open " << database_uri << ":"
+            << storage::data::Environment::error() << std::endl;
+        delete conn;
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.opened;
+    return conn;
+}
+
+inline bool example_connection_pool::is_healthy(pooled_connection * conn)
+{
+    if (std::chrono::steady_clock::now() - conn->released_at < health_check_interval) {
+        return true;
+    }
+    // A transaction can only begin on a usable connection.
+    storage::ittiadb::Transaction txn(conn->db);
+    if (DB_OK != txn.begin()) {
+        return false;
+    }
+    return DB_OK == txn.rollback();
+}
+
+inline void example_connection_pool::discard(pooled_connection * conn)
+{
+    delete conn;
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.discarded;
+    --in_use;
+    available.notify_one();
+}
+
+inline example_connection_pool::pooled_connection *
+example_connection_pool::acquire(int32_t timeout_milliseconds)
+{
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    const std::chrono::steady_clock::time_point deadline = started + std::chrono::milliseconds(timeout_milliseconds);
+
+    for (;;) {
+        pooled_connection * conn = NULL;
+        bool must_open = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bool waited = false;
+            while (idle.empty() && in_use + opening >= max_size) {
+                waited = true;
+                if (timeout_milliseconds < 0) {
+                    available.wait(lock);
+                }
+                else if (std::cv_status::timeout == available.wait_until(lock, deadline)
+                         && idle.empty() && in_use + opening >= max_size)
+                {
+                    ++stats.timeouts;
+                    return NULL;
+                }
+            }
+            if (waited) {
+                const uint64_t waited_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - started).count();
+                ++stats.waits;
+                stats.total_wait_microseconds += waited_us;
+                if (waited_us > stats.max_wait_microseconds) {
+                    stats.max_wait_microseconds = waited_us;
+                }
+            }
+            if (!idle.empty()) {
+                // Most recently used connection first: its pages are likely cached.
+                conn = idle.back();
+                idle.pop_back();
+                ++in_use;
+            }
+            else {
+                must_open = true;
+                ++opening;
+            }
+        }
+
+        if (must_open) {
+            conn = open_connection();
+            std::lock_guard<std::mutex> lock(mutex);
+            --opening;
+            if (conn == NULL) {
+                available.notify_one();
+                return NULL;
+            }
+            ++in_use;
+            ++stats.acquired;
+            return conn;
+        }
+
+        if (is_healthy(conn)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++stats.acquired;
+            return conn;
+        }
+        // Broken connection: close it and try again.
+        discard(conn);
+    }
+}
+
+inline void example_connection_pool::release(pooled_connection * conn)
+{
+    bool rolled_back = false;
+    storage::ittiadb::Transaction txn(conn->db);
+    if (txn.isActive()) {
+        // Do not hand out a connection in the middle of someone else's transaction.
+        (void)txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+        rolled_back = true;
+    }
+    conn->close_exclusive_tables();
+    conn->released_at = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rolled_back) {
+        ++stats.rollbacks;
+    }
+    --in_use;
+    idle.push_back(conn);
+    available.notify_one();
+}
+
+inline void example_connection_pool::close_idle()
+{
+    std::vector<pooled_connection *> closing;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing.swap(idle);
+    }
+    for (size_t i = 0; i < closing.size(); ++i) {
+        delete closing[i];
+    }
+}
+
+inline example_connection_pool::statistics_t example_connection_pool::statistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    statistics_t result = stats;
+    result.idle = idle.size();
+    result.in_use = in_use;
+    return result;
+}
+
+/// Output connection pool usage counters.
+inline std::ostream& operator<<(std::ostream& os, const example_connection_pool::statistics_t& stats)
+{
+    os << "acquired: " << stats.acquired
+        << ", opened: " << stats.opened
+        << ", discarded: " << stats.discarded
+        << ", rollbacks: " << stats.rollbacks
+        << ", waits: " << stats.waits
+        << " (avg " << (stats.waits ? stats.total_wait_microseconds / stats.waits : 0)
+        << " us, max " << stats.max_wait_microseconds << " us)"
+        << ", timeouts: " << stats.timeouts
+        << ", idle/in use: " << stats.idle << "/" << stats.in_use;
+    return os;
+}
+
+#endif
@@ -0,0 +1,273 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef EXAMPLE_LOG_H
+#define EXAMPLE_LOG_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "example_task_queue.h"
+#include "example_thread.h"
+
+/// Log levels, lowest first.
+#define EXAMPLE_LOG_LEVEL_DEBUG 0
+#define EXAMPLE_LOG_LEVEL_INFO  1
+#define EXAMPLE_LOG_LEVEL_WARN  2
+#define EXAMPLE_LOG_LEVEL_ERROR 3
+
+/// Messages below this level are removed at compile time. Debug messages
+/// are kept only in builds that define DEBUG or _DEBUG, as the Debug
+/// configurations do, unless the level is set on the compiler command
+/// line, e.g. -DEXAMPLE_LOG_MIN_LEVEL=0.
+#ifndef EXAMPLE_LOG_MIN_LEVEL
+#if defined(DEBUG) || defined(_DEBUG)
+#define EXAMPLE_LOG_MIN_LEVEL EXAMPLE_LOG_LEVEL_DEBUG
+#else
+#define EXAMPLE_LOG_MIN_LEVEL EXAMPLE_LOG_LEVEL_INFO
+#endif
+#endif
+
+/// Asynchronous logger for ITTIA C++ examples.
+///
+/// Writing to std::cout with std::endl flushes the stream, which costs a
+/// system call for every message. The logger instead formats the message
+/// in the calling thread and pushes it to a lock-free ring; a background
+/// thread writes queued messages in batches and flushes once per batch.
+///
+/// Use the EXAMPLE_LOG_* macros rather than calling the logger directly,
+/// so messages below EXAMPLE_LOG_MIN_LEVEL cost nothing:
+///
+///     EXAMPLE_LOG_DEBUG("(add_host): Add Host_" << hostid);
+///
+/// Debug and info messages go to std::cout, warnings and errors to
+/// std::cerr. If the ring is full, the message is dropped and counted
+/// rather than blocking the caller, except for errors, which are then
+/// written to std::cerr directly. Call example_log_flush() before
+/// writing to std::cout directly, so output appears in order.
+class example_logger
+{
+public:
+    /// The process-wide logger. The drain thread starts on first use and
+    /// is stopped, after writing the remaining messages, at exit.
+    static example_logger& instance();
+
+    ~example_logger();
+
+    /// Queue @a text at @a level.
+    void write(int level, const std::string& text);
+
+    /// Wait until all messages queued so far are written.
+    void flush();
+
+    /// Number of messages other than errors dropped because the ring was full.
+    int64_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+
+private:
+    example_logger();
+    example_logger(const example_logger&);
+    example_logger& operator=(const example_logger&);
+
+    /// Longer messages are truncated.
+    static const size_t MAX_MESSAGE_LEN = 255;
+    static const size_t RING_CAPACITY = 4096;
+    /// Wake the drain thread early once this many messages are queued.
+    static const size_t DRAIN_THRESHOLD = RING_CAPACITY / 4;
+    static const int32_t DRAIN_INTERVAL_MS = 20;
+
+    struct record_t {
+        int level;
+        char text[MAX_MESSAGE_LEN + 1];
+    };
+
+    static void drain_proc(void * arg);
+    void drain();
+
+private:
+    example_task_queue<record_t> ring;
+    example_event wakeup;
+    std::atomic<bool> stopping;
+    std::atomic<int64_t> queued_count;
+    std::atomic<int64_t> written_count;
+    std::atomic<int64_t> dropped_count;
+    /// Signalled by drain() after each batch, for flush()
+    std::mutex written_mutex;
+    std::condition_variable batch_written;
+    example_thread * thread;
+};
+
+#define EXAMPLE_LOG_(level, message)                                  \
+    do {                                                              \
+        std::ostringstream example_log_stream_;                       \
+        example_log_stream_ << message;                               \
+        example_logger::instance().write(level, example_log_stream_.str()); \
+    } while (0)
+
+#if EXAMPLE_LOG_MIN_LEVEL <= EXAMPLE_LOG_LEVEL_DEBUG
+#define EXAMPLE_LOG_DEBUG(message) EXAMPLE_LOG_(EXAMPLE_LOG_LEVEL_DEBUG, message)
+#else
+#define EXAMPLE_LOG_DEBUG(message) do {} while (0)
+#endif
+
+#if EXAMPLE_LOG_MIN_LEVEL <= EXAMPLE_LOG_LEVEL_INFO
+#define EXAMPLE_LOG_INFO(message) EXAMPLE_LOG_(EXAMPLE_LOG_LEVEL_INFO, message)
+#else
+#define EXAMPLE_LOG_INFO(message) do {} while (0)
+#endif
+
+#if EXAMPLE_LOG_MIN_LEVEL <= EXAMPLE_LOG_LEVEL_WARN
+#define EXAMPLE_LOG_WARN(message) EXAMPLE_LOG_(EXAMPLE_LOG_LEVEL_WARN, message)
+#else
+#define EXAMPLE_LOG_WARN(message) do {} while (0)
+#endif
+
+/// Errors are never removed.
+#define EXAMPLE_LOG_ERROR(message) EXAMPLE_LOG_(EXAMPLE_LOG_LEVEL_ERROR, message)
+
+/// Write all queued messages before returning.
+inline void example_log_flush()
+{
+    example_logger::instance().flush();
+}
+
+
+inline example_logger& example_logger::instance()
+{
+    static example_logger logger;
+    return logger;
+}
+
+inline example_logger::example_logger()
+    : ring(RING_CAPACITY)
+    , wakeup(true)
+    , stopping(false)
+    , queued_count(0)
+    , written_count(0)
+    , dropped_count(0)
+    , written_mutex()
+    , batch_written()
+    , thread(NULL)
+{
+    thread = new example_thread(drain_proc, this);
+}
+
+inline example_logger::~example_logger()
+{
+    stopping.store(true);
+    wakeup.set();
+    thread->join();
+    delete thread;
+
+    if (dropped() > 0) {
+        std::cerr << dropped() << " log messages dropped" << std::endl;
+    }
+}
+
+inline void example_logger::write(int level, const std::string& text)
+{
+    record_t record;
+    size_t length = text.size() < MAX_MESSAGE_LEN ? text.size() : MAX_MESSAGE_LEN;
+
+    record.level = level;
+    memcpy(record.text, text.c_str(), length);
+    record.text[length] = '\0';
+
+    if (!ring.push(record)) {
+        wakeup.set();
+        if (level >= EXAMPLE_LOG_LEVEL_ERROR) {
+            // Never lose an error: write it out of order instead
+            std::cerr << record.text << std::endl;
+        }
+        else {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    if (queued_count.fetch_add(1, std::memory_order_relaxed) + 1
+        - written_count.load(std::memory_order_relaxed) >= (int64_t)DRAIN_THRESHOLD)
+    {
+        wakeup.set();
+    }
+}
+
+inline void example_logger::flush()
+{
+    const int64_t target = queued_count.load();
+    wakeup.set();
+    std::unique_lock<std::mutex> lock(written_mutex);
+    while (written_count.load() < target) {
+        batch_written.wait(lock);
+    }
+}
+
+inline void example_logger::drain_proc(void * arg)
+{
+    example_logger * logger = static_cast<example_logger *>(arg);
+    while (!logger->stopping.load()) {
+        logger->wakeup.wait_for_milliseconds(DRAIN_INTERVAL_MS);
+        logger->drain();
+    }
+    // Messages queued before the stop request
+    logger->drain();
+}
+
+inline void example_logger::drain()
+{
+    record_t record;
+    int64_t written = 0;
+    bool to_cout = false;
+    bool to_cerr = false;
+
+    while (ring.pop(record)) {
+        if (record.level >= EXAMPLE_LOG_LEVEL_WARN) {
+            std::cerr << record.text << '\n';
+            to_cerr = true;
+        }
+        else {
+            std::cout << record.text << '\n';
+            to_cout = true;
+        }
+        ++written;
+    }
+    // One flush per batch instead of one per message
+    if (to_cout) {
+        std::cout.flush();
+    }
+    if (to_cerr) {
+        std::cerr.flush();
+    }
+    if (written > 0) {
+        // Taking the lock orders this update before a waiter's check
+        std::lock_guard<std::mutex> lock(written_mutex);
+        written_count.fetch_add(written);
+        batch_written.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,175 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef EXAMPLE_STORAGE_FILL_H
+#define EXAMPLE_STORAGE_FILL_H
+
+#include <stdint.h>
+#include <iostream>
+
+#include "storage/data/environment.h"
+#include "storage/data/single_row.h"
+#include "storage/ittiadb/connection.h"
+#include "storage/ittiadb/query.h"
+#include "storage/ittiadb/transaction.h"
+#include "db_iostream.h"
+
+/// Rows inserted per transaction while filling, until the storage is
+/// almost full.
+static const int64_t EXAMPLE_FILL_BATCH = 256;
+/// Stop filling a storage that never runs out of pages.
+static const int64_t EXAMPLE_MAX_FILL_ROWS = 10000000;
+
+/// Schema and rows that example_fill_storage() puts into a memory storage.
+class example_storage_filler
+{
+public:
+    virtual ~example_storage_filler() {}
+
+    /// Create the tables and indexes in a new, empty @a database, and any
+    /// rows the filled rows refer to.
+    virtual int create_schema(storage::ittiadb::Connection& database) = 0;
+
+    /// Statement that inserts one row.
+    virtual const char * insert_sql() const = 0;
+
+    /// Set the insert parameters of row @a row_number, counted from 1.
+    /// Keys must stay unique.
+    virtual void set_row(int64_t row_number, storage::data::Row& params) = 0;
+};
+
+/// Create a memory storage database of @a pages pages of @a page_size
+/// bytes, create the schema of @a filler in it and insert rows until the
+/// storage runs out of pages. The database is closed afterwards.
+///
+/// @param rows
+///  Number of rows committed before the storage ran out of pages.
+inline int example_fill_storage(const char * database_uri, example_storage_filler& filler,
+                                int64_t page_size, int64_t pages, int64_t& rows)
+{
+    int rc = DB_NOERROR;
+    storage::ittiadb::Connection database(database_uri);
+    storage::ittiadb::Connection::MemoryStorageConfig memory_storage_config;
+
+    rows = 0;
+    memory_storage_config.memory_page_size = page_size;
+    memory_storage_config.memory_storage_size = page_size * pages;
+    if (DB_NOERROR != GET_ECODE(rc,
+        database.open(storage::ittiadb::Connection::CreateAlways, memory_storage_config),
+        "Database open failed "))
+    {
+        return rc;
+    }
+    if (DB_NOERROR != (rc = filler.create_schema(database))) {
+        database.close();
+        return rc;
+    }
+
+    storage::ittiadb::Query insert(database, filler.insert_sql());
+    if (DB_NOERROR == GET_ECODE(rc, insert.prepare(), "Insert prepare failed ")) {
+        storage::data::SingleRow params(insert.parameters());
+        int64_t batch = EXAMPLE_FILL_BATCH;
+
+        while (DB_NOERROR == rc && rows < EXAMPLE_MAX_FILL_ROWS) {
+            storage::ittiadb::Transaction txn(database);
+            int64_t n = 0;
+
+            if (DB_OK != txn.begin()) {
+                rc = storage::data::Environment::error().code;
+            }
+            while (DB_NOERROR == rc && n < batch) {
+                filler.set_row(rows + n + 1, params);
+                if (1 != insert.execute_with(params)) {
+                    rc = storage::data::Environment::error().code;
+                }
+                else {
+                    ++n;
+                }
+            }
+            if (DB_NOERROR == rc && DB_OK != txn.commit()) {
+                rc = storage::data::Environment::error().code;
+            }
+            if (DB_NOERROR == rc) {
+                rows += n;
+                continue;
+            }
+
+            txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+            if (DB_ENOPAGESPACE != rc && DB_ENOMEM != rc) {
+                std::cerr << "Insert into " << database_uri << " failed :: "
+                          << storage::data::Environment::error() << std::endl;
+            }
+            else if (batch > 1) {
+                // Close to full: find the exact row count one row at a time
+                batch = 1;
+                rc = DB_NOERROR;
+            }
+            else {
+                // Full
+                rc = DB_NOERROR;
+                break;
+            }
+        }
+        if (rows >= EXAMPLE_MAX_FILL_ROWS) {
+            std::cerr << "Storage of " << database_uri << " never filled up" << std::endl;
+            rc = DB_FAILURE;
+        }
+    }
+
+    database.close();
+    return rc;
+}
+
+/// Storage bytes taken by each row of @a filler, and by the database with
+/// its empty schema, at @a page_size.
+///
+/// Storages of @a pages and of twice as many pages are filled. The extra
+/// pages of the larger one hold only rows, so they give the bytes per row;
+/// what the rows don't take of the smaller one is the fixed cost.
+inline int example_measure_row_bytes(const char * database_uri, example_storage_filler& filler,
+                                     int64_t page_size, int64_t pages,
+                                     double& bytes_per_row, int64_t& fixed_bytes)
+{
+    int rc;
+    int64_t small_rows = 0;
+    int64_t large_rows = 0;
+
+    if (DB_NOERROR != (rc = example_fill_storage(database_uri, filler, page_size, pages, small_rows))
+        || DB_NOERROR != (rc = example_fill_storage(database_uri, filler, page_size, pages * 2, large_rows)))
+    {
+        return rc;
+    }
+    if (large_rows <= small_rows) {
+        std::cerr << "Rows don't fit in " << pages * 2 << " pages of " << page_size << " bytes" << std::endl;
+        return DB_FAILURE;
+    }
+
+    bytes_per_row = (double)(pages * page_size) / (double)(large_rows - small_rows);
+    fixed_bytes = pages * page_size - (int64_t)(bytes_per_row * (double)small_rows);
+    if (fixed_bytes < 0) {
+        fixed_bytes = 0;
+    }
+    return DB_NOERROR;
+}
+
+#endif
@@ -0,0 +1,146 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef EXAMPLE_TASK_QUEUE_H
+#define EXAMPLE_TASK_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/// Bounded lock-free multi-producer, multi-consumer queue.
+///
+/// Each cell carries a sequence number that tells producers and consumers
+/// whether the cell is free or filled for the current lap around the ring,
+/// so push and pop only need a single compare-and-swap on the shared index.
+template <typename T>
+class example_task_queue
+{
+public:
+    /// Create a queue holding at least @a min_capacity items. The capacity
+    /// is rounded up to a power of two.
+    explicit example_task_queue(size_t min_capacity);
+
+    /// Append @a item. Returns false if the queue is full.
+    bool push(const T& item);
+
+    /// Remove the oldest item into @a item. Returns false if the queue is empty.
+    bool pop(T& item);
+
+    /// Approximate number of queued items.
+    size_t size() const;
+
+private:
+    example_task_queue(const example_task_queue&);
+    example_task_queue& operator=(const example_task_queue&);
+
+    struct cell_t {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::vector<cell_t> cells;
+    size_t mask;
+    std::atomic<size_t> enqueue_pos;
+    std::atomic<size_t> dequeue_pos;
+};
+
+
+template <typename T>
+inline example_task_queue<T>::example_task_queue(size_t min_capacity)
+    : cells()
+    , mask(0)
+    , enqueue_pos(0)
+    , dequeue_pos(0)
+{
+    size_t capacity = 2;
+    while (capacity < min_capacity) {
+        capacity <<= 1;
+    }
+    std::vector<cell_t> ring(capacity);
+    cells.swap(ring);
+    mask = capacity - 1;
+    for (size_t i = 0; i < capacity; ++i) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+inline bool example_task_queue<T>::push(const T& item)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        cell_t& cell = cells[pos & mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.data = item;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            // Cell still holds an item from the previous lap: queue is full.
+            return false;
+        }
+        else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+inline bool example_task_queue<T>::pop(T& item)
+{
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        cell_t& cell = cells[pos & mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                item = cell.data;
+                cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            // Cell has not been filled for this lap yet: queue is empty.
+            return false;
+        }
+        else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+inline size_t example_task_queue<T>::size() const
+{
+    size_t head = dequeue_pos.load(std::memory_order_relaxed);
+    size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif
@@ -24,6 +24,11 @@
 #ifndef EXAMPLE_THREAD_H
 #define EXAMPLE_THREAD_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
 #include <ittia/os/os_thread.h>
 #include <ittia/os/os_wait_time.h>
 
@@ -50,6 +55,50 @@ private:
     os_thread_t * thread;
 };
 
+/// Event for signalling between ITTIA C++ example threads.
+///
+/// A thread blocked in wait() wakes as soon as another thread calls set(),
+/// instead of polling a flag with sleep_for_milliseconds().
+class example_event
+{
+public:
+    /// Create an event in the non-signalled state.
+    ///
+    /// @param auto_reset
+    ///  If true, each successful wait resets the event, so every set() is
+    ///  consumed by exactly one waiter. Otherwise the event stays signalled
+    ///  until reset() is called.
+    explicit example_event(bool auto_reset = false);
+
+    /// Signal the event and wake waiting threads.
+    void set();
+
+    /// Return the event to the non-signalled state.
+    void reset();
+
+    /// Check whether the event is signalled without waiting.
+    bool is_set() const;
+
+    /// Wait until the event is signalled.
+    void wait();
+
+    /// Wait until the event is signalled or @a milliseconds have elapsed.
+    /// Returns true if the event was signalled.
+    bool wait_for_milliseconds(int32_t milliseconds);
+
+private:
+    example_event(const example_event&);
+    example_event& operator=(const example_event&);
+
+    bool consume();
+
+private:
+    const bool auto_reset;
+    std::atomic<bool> signalled;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
 
 inline example_thread::example_thread(thread_proc_t task, void * arg)
 {
@@ -71,4 +120,61 @@ inline void example_thread::sleep_for_milliseconds(int32_t milliseconds)
     (void)os_sleep(WAIT_MILLISEC(milliseconds));
 }
 
+inline example_event::example_event(bool auto_reset)
+    : auto_reset(auto_reset)
+    , signalled(false)
+{
+}
+
+inline void example_event::set()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    signalled.store(true);
+    if (auto_reset) {
+        cond.notify_one();
+    }
+    else {
+        cond.notify_all();
+    }
+}
+
+inline void example_event::reset()
+{
+    signalled.store(false);
+}
+
+inline bool example_event::is_set() const
+{
+    return signalled.load();
+}
+
+inline bool example_event::consume()
+{
+    if (auto_reset) {
+        return signalled.exchange(false);
+    }
+    return signalled.load();
+}
+
+inline void example_event::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!consume()) {
+        cond.wait(lock);
+    }
+}
+
+inline bool example_event::wait_for_milliseconds(int32_t milliseconds)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    while (!consume()) {
+        if (std::cv_status::timeout == cond.wait_until(lock, deadline)) {
+            return consume();
+        }
+    }
+    return true;
+}
+
 #endif
@@ -0,0 +1,270 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef EXAMPLE_THREAD_POOL_H
+#define EXAMPLE_THREAD_POOL_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "storage/data/environment.h"
+#include "storage/ittiadb/connection.h"
+#include "db_iostream.h"
+#include "example_task_queue.h"
+#include "example_thread.h"
+
+/// Fixed-size pool of worker threads for ITTIA C++ examples.
+///
+/// Tasks are queued with submit() and run by the first idle worker. When
+/// the pool is given a database URI, each worker owns one database
+/// connection for its whole lifetime, so tasks that run on the same worker
+/// reuse the same connection instead of opening a new one. Results are
+/// returned through a std::future.
+///
+/// A task that is not run, because it was submitted after shutdown() or
+/// picked up by a worker that could not open its connection, is dropped:
+/// get() on its future throws std::future_error with
+/// std::future_errc::broken_promise.
+class example_thread_pool
+{
+public:
+    typedef example_thread::thread_proc_t thread_proc_t;
+
+    /// Start @a thread_count workers.
+    ///
+    /// @param database_uri
+    ///  If not NULL, each worker opens its own connection to this existing
+    ///  database before running any task, and drops the tasks it picks up
+    ///  if the connection can't be opened. Otherwise, no connections are
+    ///  allocated and tasks are passed a shared connection that is never
+    ///  opened.
+    /// @param queue_capacity
+    ///  Number of tasks that can wait in the queue before submit() blocks.
+    example_thread_pool(size_t thread_count, const char * database_uri = NULL, size_t queue_capacity = 1024);
+
+    /// Finish all queued tasks and stop the workers.
+    ~example_thread_pool();
+
+    /// Queue @a task to run in a worker thread. The task is called with the
+    /// worker's own connection and its result is available from the
+    /// returned future.
+    template <typename F>
+    std::future<decltype(std::declval<F&>()(std::declval<storage::ittiadb::Connection&>()))>
+    submit(F task);
+
+    /// Queue a plain thread procedure, as accepted by example_thread.
+    std::future<void> submit(thread_proc_t task, void * arg);
+
+    /// Finish all queued tasks and wait for the workers to exit.
+    /// Tasks submitted afterwards are dropped.
+    void shutdown();
+
+    /// Number of worker threads.
+    size_t size() const { return workers.size(); }
+
+private:
+    example_thread_pool(const example_thread_pool&);
+    example_thread_pool& operator=(const example_thread_pool&);
+
+    typedef std::function<void(storage::ittiadb::Connection&)> task_t;
+
+    struct worker_t {
+        example_thread_pool * pool;
+        storage::ittiadb::Connection * connection;
+        example_thread * thread;
+    };
+
+    static void worker_proc(void * arg);
+    /// Returns false, without queuing @a task, once the pool is stopping.
+    bool enqueue(task_t * task);
+
+private:
+    const char * database_uri;
+    /// Passed to tasks when the pool has no database URI.
+    storage::ittiadb::Connection no_connection;
+    example_task_queue<task_t *> queue;
+    std::vector<worker_t *> workers;
+
+    /// Guards sleeping workers, producers and the stopping flag. Tasks are
+    /// pushed under it, so none is queued after the workers exit; workers
+    /// pop without it.
+    std::mutex idle_mutex;
+    std::condition_variable task_ready;
+    std::condition_variable space_ready;
+    std::atomic<bool> stopping;
+    std::atomic<int> blocked_producers;
+};
+
+
+inline example_thread_pool::example_thread_pool(size_t thread_count, const char * database_uri, size_t queue_capacity)
+    : database_uri(database_uri)
+    , no_connection()
+    , queue(queue_capacity)
+    , workers()
+    , stopping(false)
+    , blocked_producers(0)
+{
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        worker_t * worker = new worker_t;
+        worker->pool = this;
+        worker->connection = database_uri != NULL
+            ? new storage::ittiadb::Connection(database_uri)
+            : NULL;
+        worker->thread = NULL;
+        workers.push_back(worker);
+    }
+    // Start threads only after the worker list is complete.
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread = new example_thread(worker_proc, workers[i]);
+    }
+}
+
+inline example_thread_pool::~example_thread_pool()
+{
+    shutdown();
+}
+
+template <typename F>
+inline std::future<decltype(std::declval<F&>()(std::declval<storage::ittiadb::Connection&>()))>
+example_thread_pool::submit(F task)
+{
+    typedef decltype(std::declval<F&>()(std::declval<storage::ittiadb::Connection&>())) result_t;
+
+    std::shared_ptr<std::packaged_task<result_t(storage::ittiadb::Connection&)> > packaged(
+        new std::packaged_task<result_t(storage::ittiadb::Connection&)>(task));
+    std::future<result_t> result = packaged->get_future();
+
+    task_t * queued = new task_t([packaged](storage::ittiadb::Connection& connection) {
+        (*packaged)(connection);
+    });
+    if (!enqueue(queued)) {
+        // Dropping the last copy of the task breaks its promise
+        delete queued;
+    }
+    return result;
+}
+
+inline std::future<void> example_thread_pool::submit(thread_proc_t task, void * arg)
+{
+    return submit([task, arg](storage::ittiadb::Connection&) {
+        task(arg);
+    });
+}
+
+inline bool example_thread_pool::enqueue(task_t * task)
+{
+    // Holding the lock orders this push before a worker's empty-queue
+    // check and before shutdown() sets stopping.
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    for (;;) {
+        if (stopping.load()) {
+            return false;
+        }
+        if (queue.push(task)) {
+            break;
+        }
+        // Queue is full: wait for a worker to take a task.
+        ++blocked_producers;
+        space_ready.wait_for(lock, std::chrono::milliseconds(10));
+        --blocked_producers;
+    }
+    task_ready.notify_one();
+    return true;
+}
+
+inline void example_thread_pool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        if (stopping.exchange(true)) {
+            return;
+        }
+        task_ready.notify_all();
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread->join();
+        delete workers[i]->thread;
+        delete workers[i]->connection;
+        delete workers[i];
+    }
+    workers.clear();
+}
+
+inline void example_thread_pool::worker_proc(void * arg)
+{
+    worker_t * worker = static_cast<worker_t *>(arg);
+    example_thread_pool * pool = worker->pool;
+    storage::ittiadb::Connection& connection =
+        worker->connection != NULL ? *worker->connection : pool->no_connection;
+
+    bool connected = true;
+    if (worker->connection != NULL
+        && DB_OK != connection.open(storage::ittiadb::Connection::OpenExisting))
+    {
+        std::cerr << "Worker could not open " << pool->database_uri << ": "
+            << storage::data::Environment::error() << std::endl;
+        connected = false;
+    }
+
+    for (;;) {
+        task_t * task = NULL;
+        if (pool->queue.pop(task)) {
+            if (pool->blocked_producers.load() > 0) {
+                pool->space_ready.notify_one();
+            }
+            if (connected) {
+                (*task)(connection);
+            }
+            // A task that didn't run breaks its promise here
+            delete task;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(pool->idle_mutex);
+        if (pool->queue.size() == 0) {
+            // Queued tasks are always finished before the worker exits.
+            if (pool->stopping.load()) {
+                break;
+            }
+            pool->task_ready.wait(lock);
+        }
+    }
+
+    if (worker->connection != NULL && connected) {
+        (void)connection.close();
+    }
+}
+
+#endif
@@ -35,6 +35,7 @@
 #include "storage/ittiadb/query.h"
 #include "storage/data/single_row.h"
 #include "db_iostream.h"
+#include "example_log.h"
 
 static const char* EXAMPLE_DATABASE = "atomic_file_storage.ittiadb";
 
@@ -58,7 +59,7 @@ example_main(int argc, char *argv[])
     rc = database.open(storage::ittiadb::Connection::CreateAlways, file_storage_config);
     if (DB_OK != rc)
     {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -73,7 +74,7 @@ example_main(int argc, char *argv[])
                                                       ).execute();
     // Some functions return a useful value or -1 for failure.
     if (rows_affected < 0) {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -82,7 +83,7 @@ example_main(int argc, char *argv[])
     rc = database.open(storage::ittiadb::Connection::OpenExisting);
     if (DB_OK != rc)
     {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     
@@ -93,8 +94,8 @@ example_main(int argc, char *argv[])
     rc = txn.begin();
     if (DB_OK != rc)
     {
-        std::cerr << "Error beginning transaction: " 
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error beginning transaction: " 
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     
@@ -107,8 +108,8 @@ example_main(int argc, char *argv[])
     rc = table.insert(row);
     if (DB_OK != rc)
     {
-        std::cerr << "Error inserting a row: [" << row<<"] " 
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error inserting a row: [" << row<<"] " 
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -120,8 +121,8 @@ example_main(int argc, char *argv[])
     rc = table.insert(row);
     if (DB_OK != rc)
     {
-        std::cerr << "Error inserting a row: [" << row << "] "
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error inserting a row: [" << row << "] "
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -133,8 +134,8 @@ example_main(int argc, char *argv[])
     rc = table.insert(row);
     if (DB_OK != rc)
     {
-        std::cerr << "Error inserting a row: [" << row << "] "
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error inserting a row: [" << row << "] "
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     // Commit after inserting 3 records; don't commit the last 2 rows.
@@ -142,8 +143,8 @@ example_main(int argc, char *argv[])
     rc = (DB_OK == rc)? txn.begin():rc;
     if (DB_OK != rc)
     {
-        std::cerr << "Error commiting & begin transaction: " 
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error commiting & begin transaction: " 
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     //Add fourth row
@@ -154,8 +155,8 @@ example_main(int argc, char *argv[])
     rc = table.insert(row);
     if (DB_OK != rc)
     {
-        std::cerr << "Error inserting a row: [" << row << "] "
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error inserting a row: [" << row << "] "
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     //Add fifth row
@@ -166,8 +167,8 @@ example_main(int argc, char *argv[])
     rc = table.insert(row);
     if (DB_OK != rc)
     {
-        std::cerr << "Error inserting a row: [" << row << "] "
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error inserting a row: [" << row << "] "
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -179,7 +180,7 @@ example_main(int argc, char *argv[])
     rc = database.open(storage::ittiadb::Connection::OpenExisting);
     if (DB_OK != rc)
     {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -189,16 +190,18 @@ example_main(int argc, char *argv[])
     rc = table_readback.fetch(result_set);
     if (DB_OK != rc)
     {
-        std::cerr << "Table fetch failed "<< storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Table fetch failed "<< storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     if (result_set.size() != 3)
     {
-        std::cerr << " Unexpected records count in table after reopen: "
-            <<result_set.size()<<" but 3 expected. " << std::endl;
+        EXAMPLE_LOG_ERROR(" Unexpected records count in table after reopen: "
+            <<result_set.size()<<" but 3 expected. ");
         return EXIT_FAILURE;
     }
 
+    example_log_flush();
+
     std::cout << "Enter SQL statements or an empty line to exit" << std::endl;
     sql_line_shell(database);
 
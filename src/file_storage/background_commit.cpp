@@ -35,6 +35,8 @@
 #include "storage/ittiadb/query.h"
 #include "storage/data/single_row.h"
 #include "db_iostream.h"
+#include "db_cursor.h"
+#include "example_log.h"
 
 static const char* EXAMPLE_DATABASE = "background_commit.ittidb";
 
@@ -60,7 +62,7 @@ example_main(int argc, char *argv[])
     db_rc = database.open(storage::ittiadb::Connection::CreateAlways);
     if (DB_OK != db_rc)
     {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -75,8 +77,8 @@ example_main(int argc, char *argv[])
                                                       ).execute();
     // Some functions return a useful value or -1 for failure.
     if (rows_affected < 0) {
-        std::cerr << "Database schema creation failed: " 
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Database schema creation failed: " 
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -117,8 +119,8 @@ example_main(int argc, char *argv[])
         }
     }
     if (DB_OK != db_rc) {
-        std::cerr << " Error inserting or commiting " 
-            << storage::data::Environment::error()<<std::endl;
+        EXAMPLE_LOG_ERROR(" Error inserting or commiting " 
+            << storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     table.close();
@@ -129,29 +131,28 @@ example_main(int argc, char *argv[])
     db_rc = database.open(storage::ittiadb::Connection::OpenExisting);
     if (DB_OK != db_rc)
     {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     storage::ittiadb::Table table_readback(database, "tablename");
-    table_readback.open();
-    storage::data::RowSet<> result_set(table_readback.columns());
-    db_rc = table_readback.fetch(result_set);
+    db_rc = table_readback.open("pkname");
     if (DB_OK != db_rc)
     {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
-    table_readback.close();
 
+    // Scan the table in primary key order without loading it all at once
     trans_stat_t readback_stat = { 0, 0 };
     int counter = 0;
     int f1 =0;
     float f2 =0.0f;
-    for (storage::data::RowSet<>::const_iterator iter = result_set.begin(); 
-        iter != result_set.end(); ++iter)
+    RowCursor result_rows(table_readback, 1);
+    for (RowCursor::iterator iter = result_rows.begin(); 
+        iter != result_rows.end(); ++iter)
     {   
-        (*iter).at("int64_field").get(f1);
-        (*iter).at("float64_field").get(f2);
+        iter->at("int64_field").get(f1);
+        iter->at("float64_field").get(f2);
         if (f1 != ++counter)
         {
             break;
@@ -159,28 +160,35 @@ example_main(int argc, char *argv[])
         readback_stat.lazy_tx +=  f2 == 50 ? 1 : 0;
         readback_stat.forced_tx += f2 == 16 ? 1 : 0;
     }
+    if (DB_NOERROR != result_rows.error())
+    {
+        db_rc = DB_FAIL;
+    }
+    table_readback.close();
 
     if (DB_OK != db_rc) {
-        std::cerr <<"Error to scan table of backup db "
-                  << storage::data::Environment::error()<<std::endl;
+        EXAMPLE_LOG_ERROR("Error to scan table of backup db "
+                  << storage::data::Environment::error());
     }
     else if (f1 != counter) {
-        std::cerr << "Pkey field values sequence violation detected in backup db: (" 
-                  << f1 << "," << counter << ")" << std::endl;         
+        EXAMPLE_LOG_ERROR("Pkey field values sequence violation detected in backup db: (" 
+                  << f1 << "," << counter << ")");
     }
     else if (readback_stat.lazy_tx != stat.lazy_tx) {
-        std::cerr << "Unexpected count of records which was commited in lazy-commit mode: " 
-            << readback_stat.lazy_tx << ", but expected" << stat.lazy_tx<<std::endl;
+        EXAMPLE_LOG_ERROR("Unexpected count of records which was commited in lazy-commit mode: " 
+            << readback_stat.lazy_tx << ", but expected" << stat.lazy_tx);
     }
     else if (readback_stat.forced_tx != stat.forced_tx) {
-        std::cerr << "Unexpected count of records which was commited in force-commit mode: "
-            << readback_stat.forced_tx << ", but expected" << stat.forced_tx << std::endl;
+        EXAMPLE_LOG_ERROR("Unexpected count of records which was commited in force-commit mode: "
+            << readback_stat.forced_tx << ", but expected" << stat.forced_tx);
     }
     else {
-        std::cout<< counter << " records is inside " << std::endl;
+        EXAMPLE_LOG_INFO(counter << " records is inside ");
         rc = EXIT_SUCCESS;
     }
 
+    example_log_flush();
+
     std::cout << "Enter SQL statements or an empty line to exit" << std::endl;
     sql_line_shell(database);
 
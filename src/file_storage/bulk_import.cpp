@@ -35,6 +35,7 @@
 #include "storage/ittiadb/query.h"
 #include "storage/data/single_row.h"
 #include "db_iostream.h"
+#include "example_log.h"
 
 static const char* EXAMPLE_DATABASE = "bulk_import.ittiadb";
 
@@ -103,7 +104,7 @@ example_main(int argc, char *argv[])
     // Create database & schema with logging disabled
     if (EXIT_SUCCESS != create_database_schema(database, file_storage_config))
     {
-        std::cerr << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR(storage::data::Environment::error());
         return EXIT_FAILURE;
     }
     //Import bulk data
@@ -116,8 +117,8 @@ example_main(int argc, char *argv[])
 
     if (DB_OK != rc)
     {
-        std::cerr << "Error importing data in bulk : "
-            << storage::data::Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Error importing data in bulk : "
+            << storage::data::Environment::error());
         // Close database
         database.close();
 
@@ -127,7 +128,7 @@ example_main(int argc, char *argv[])
         // Create database & schema with logging disabled
         if (EXIT_SUCCESS != create_database_schema(database, file_storage_config))
         {
-            std::cerr << storage::data::Environment::error() << std::endl;
+            EXAMPLE_LOG_ERROR(storage::data::Environment::error());
             return EXIT_FAILURE;
         }
         // Bulk import again
@@ -136,11 +137,13 @@ example_main(int argc, char *argv[])
         rc = (DB_OK == rc) ? table.close() : rc;
         if (DB_OK == rc)
         {
-            std::cerr << "Error in importing data: " << storage::data::Environment::error() << std::endl;
+            EXAMPLE_LOG_ERROR("Error in importing data: " << storage::data::Environment::error());
             return EXIT_FAILURE;
         }
     }
 
+    example_log_flush();
+
     std::cout << "Enter SQL statements or an empty line to exit" << std::endl;
     sql_line_shell(database);
 
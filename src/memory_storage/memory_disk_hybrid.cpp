@@ -27,7 +27,19 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <sstream> 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "storage/data/environment.h"
 #include "storage/ittiadb/transaction.h"
 #include "storage/ittiadb/connection.h"
@@ -36,6 +48,13 @@
 #include "storage/data/single_row.h"
 #include "storage/data/single_field.h"
 #include "db_iostream.h"
+#include "db_cursor.h"
+#include "db_sequence.h"
+#include "example_cache_policy.h"
+#include "example_connection_pool.h"
+#include "example_log.h"
+#include "example_task_queue.h"
+#include "example_thread.h"
 
 static const char* EXAMPLE_DATABASE = "memory_disk_hybrid.ittiadb";
 
@@ -45,8 +64,43 @@ static const int32_t MAX_HOSTNAME_LEN = 50;
 static const int32_t MAX_IP_LEN = 16;
 /// Hostname count
 static const int32_t  EMULATE_HOSTSNAMES_COUNT = 230;
+/// Popular hostnames, requested far more often than the rest
+static const int32_t  POPULAR_HOSTNAMES_COUNT = 150;
 /// Max allowed client requests
 static const int32_t CLIENT_REQUESTS = 1460;
+/// Ages reserved from age_seq per database call
+static const int32_t AGE_SEQ_BLOCK = 64;
+/// How long a name the DNS server couldn't resolve is answered from the
+/// negative cache
+static const int32_t NEGATIVE_TTL_MS = 2000;
+/// Max names in the negative cache
+static const size_t NEGATIVE_CACHE_LIMIT = 1000;
+/// Requests per thread of the concurrent client driver
+static const int32_t CONCURRENT_CLIENT_REQUESTS = 2000;
+/// Emulated DNS server round trip used by the concurrent client driver
+static const int32_t UPSTREAM_LATENCY_MS = 2;
+/// Rows written to hosts_dsk per transaction when merging in-mem changes
+static const int32_t MERGE_BATCH_ROWS = 64;
+/// Default interval of the background flush of in-mem changes
+static const int32_t FLUSH_INTERVAL_MS = 500;
+/// On-disk hits waiting to be copied to the in-mem cache. More are dropped.
+static const size_t PROMOTION_QUEUE_SIZE = 256;
+/// Promotions done per hold of the connection by the promotion worker
+static const int32_t PROMOTION_BATCH = 16;
+/// Connections the resolvers borrow for lookups, one per concurrent lookup
+static const size_t LOOKUP_CONNECTIONS = 16;
+/// Writes to the cache tables committed together at most
+static const int64_t GROUP_COMMIT_MAX_BATCH = 32;
+/// Longest time a write waits for others to share its commit
+static const int32_t GROUP_COMMIT_MAX_DELAY_MS = 5;
+/// Whether a DNS answer is returned only once it is committed
+static const bool WAIT_FOR_DURABLE_ANSWERS = true;
+/// Time to live of the answers of the emulated DNS server
+static const int32_t DNS_TTL_MS = 5000;
+/// Interval of the background sweep of expired records
+static const int32_t SWEEP_INTERVAL_MS = 250;
+/// Expired records deleted per hold of the connection by the sweeper
+static const int32_t SWEEP_BATCH = 16;
 
 typedef enum {
     /// In memory 
@@ -56,15 +110,141 @@ typedef enum {
     CT_GUARD   = 2
 } cache_type_t;
 
-/// Caches sizes. - To monitor if cache should be shaped a bit
-static int64_t cache_sizes[ CT_GUARD ] = { 0, 0 };
 /// Limits to count of records into in-mem (500) and on-disk (10000) caches
-static int64_t cache_size_limits[ CT_GUARD ] = { 100, 220 };
+static const int64_t cache_size_limits[ CT_GUARD ] = { 100, 220 };
 
 /// When cache_sizes[x] limit reaches cache_size_limits[x], delete cache_del_chunks[x] count of the
-/// most aged records from cache 'x'
-static int cache_del_chunks[ CT_GUARD ] = { 1, 100 };
+/// most aged records from cache 'x'. The in-mem cache is shaped by its
+/// replacement policy instead.
+static const int cache_del_chunks[ CT_GUARD ] = { 1, 100 };
 
+/// Lookups and hits of one cache tier, counted by concurrent resolvers
+struct tier_stats_t
+{
+    std::atomic<int64_t> lookups;
+    std::atomic<int64_t> hits;
+};
+
+/// What happened to lookups that missed both cache tiers
+struct resolver_stats_t
+{
+    int64_t upstream_calls; ///< Requests sent to the DNS server
+    int64_t coalesced;      ///< Waited for a request already in flight
+    int64_t negative_hits;  ///< Answered "not found" by the negative cache
+};
+
+/// Values of a hosts_mem row that changed since it was last written to
+/// hosts_dsk
+struct host_values_t
+{
+    std::string hostip;
+    int32_t requestcount;
+    int64_t age;
+    int64_t expires;
+};
+
+/// Changed rows by hostname, which is the primary key, so iterating the map
+/// visits hosts_dsk in index order
+typedef std::map<std::string, host_values_t> dirty_rows_t;
+
+/// On-disk hit to be copied to the in-mem cache
+struct promotion_t
+{
+    std::string hostname;
+    host_values_t values;
+};
+
+
+/// Wall-clock time in milliseconds. Expiry times are stored in the cache
+/// tables, so they must stay valid across restarts.
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/// Check whether the "expires" time of cache record @a row has passed
+static bool is_expired(storage::data::Row& row, int64_t now)
+{
+    int64_t expires = 0;
+    row["expires"].get(expires);
+    return expires <= now;
+}
+
+/// Commits the writes of concurrent writers on one connection together.
+///
+/// A writer makes its changes while holding the connection's mutex and
+/// then calls add_write_locked() for a ticket, without committing. The
+/// writes are committed with one Transaction::commit when
+/// GROUP_COMMIT_MAX_BATCH of them are pending, by the writer that filled
+/// the batch, or GROUP_COMMIT_MAX_DELAY_MS after the first of them, by a
+/// background thread. A writer that needs its change to be durable passes
+/// the ticket to wait_durable(). If a commit fails, the writes it included
+/// are rolled back and the undo actions given with them are run.
+class GroupCommit
+{
+public:
+    /// Reverts what a writer changed outside the database along with a write
+    typedef std::function<void()> undo_t;
+
+    GroupCommit(storage::ittiadb::Connection& database, std::mutex& db_mutex,
+                int64_t max_batch, int32_t max_delay_ms);
+    /// Commit pending writes and stop the background thread
+    ~GroupCommit();
+
+    /// Count a write to be committed and return its ticket; db_mutex must
+    /// be held. Commits right away if the batch is full. @a undo is run,
+    /// with db_mutex held, if the commit that includes the write fails.
+    int64_t add_write_locked(const undo_t& undo = undo_t());
+    /// Commit all pending writes now; db_mutex must be held. Nothing may be
+    /// rolled back on the connection while writes are pending, so callers
+    /// about to start a transaction that can fail commit first.
+    int commit_locked();
+    /// Wait until the write with @a ticket is committed. Returns DB_NOERROR
+    /// or the error of the commit that included it.
+    int wait_durable(int64_t ticket);
+
+    /// Commits made and writes they included
+    void statistics(int64_t& commits, int64_t& writes) const;
+
+private:
+    GroupCommit(const GroupCommit&);
+    GroupCommit& operator=(const GroupCommit&);
+
+    static void committer_proc(void * arg);
+
+    /// Tickets in (from, to] were lost by a commit that failed with rc
+    struct failed_range_t
+    {
+        int64_t from;
+        int64_t to;
+        int rc;
+    };
+
+private:
+    storage::ittiadb::Connection& db;
+    std::mutex& db_mutex;
+    const int64_t max_batch;
+    const std::chrono::milliseconds max_delay;
+
+    mutable std::mutex mutex;
+    /// Wakes the background thread when the first write of a batch arrives
+    std::condition_variable pending_cv;
+    /// Wakes wait_durable() after each commit
+    std::condition_variable committed_cv;
+    int64_t written;
+    int64_t committed;
+    std::chrono::steady_clock::time_point first_pending;
+    /// Every failed commit, in ticket order. Commits rarely fail, and a
+    /// ticket may be waited for at any time after its write, so none are
+    /// forgotten.
+    std::vector<failed_range_t> failed;
+    /// Undo actions of the pending writes; guarded by db_mutex
+    std::vector<undo_t> pending_undo;
+    int64_t commits;
+    bool stopping;
+    std::unique_ptr<example_thread> committer;
+};
 
 /// Class to manage cache operations on hybrid database
 class ManageHybridDatabase
@@ -75,7 +255,14 @@ public:
     /// @param connection
     ///  A database connection object. The connection must be opened before
     ///  any member functions can be used.
-    ManageHybridDatabase(storage::ittiadb::Connection& database);
+    /// @param database_uri
+    ///  URI of the same database. Lookups and ages use connections of
+    ///  their own to it.
+    /// @param mem_policy
+    ///  Decides which on-disk hits are copied to the in-mem cache and which
+    ///  in-mem records are evicted to make room for them.
+    ManageHybridDatabase(storage::ittiadb::Connection& database, const char * database_uri,
+                         example_cache_policy& mem_policy);
     /// Destructor
     ~ManageHybridDatabase();
     /// Main entry points for clients.
@@ -87,23 +274,202 @@ public:
     ///         - mem cache.Increment inmem request count /s tatistics;
     ///     -If search both chaches failed, request 'dns-server' (fake generator in this example) to resolve.
     ///     Put resolved data in both in - mem & on - disk caches;
+    ///
+    /// Safe to call from several threads. Each lookup borrows a connection
+    /// of its own, so lookups run side by side and only wait for each
+    /// other on the rows they share. Concurrent misses for the same name
+    /// share one DNS request, and names the DNS server couldn't resolve
+    /// are answered with DB_ENOTFOUND for NEGATIVE_TTL_MS.
     /// @param hostname
     /// A host name
     /// @param ip
     /// A host ip address
     int resolve_ip_by_hostname(const std::string& hostname, std::string& ip);
-    /// Copy the most recent cache records into in-mem cache ( on application start )
+    /// Warm up the in-mem cache on application start: load the on-disk
+    /// records with the highest request count, then age, until the in-mem
+    /// cache is full. They are read in hosts_hot_idx order from the top
+    /// down, so only the rows loaded are read. The on-disk row count is
+    /// taken from sdb_save_disk_row_count, if the last run saved it.
     int sdb_copy_disk_to_mem_cache();
-    /// When application starts copy the most recent cache records into in-mem cache
+    /// Save the on-disk row count at a clean shutdown, so the next start
+    /// does not have to count the rows of hosts_dsk.
+    int sdb_save_disk_row_count();
+    /// Write in-mem rows changed since the last merge to the on-disk cache,
+    /// in primary key order and MERGE_BATCH_ROWS rows per transaction
     int sdb_merge_mem_cache_to_disk();
+    /// Write changed in-mem rows to the on-disk cache from a background
+    /// thread every @a interval_ms, so a crash loses at most the changes of
+    /// one interval. The flusher holds the connection for one batch of
+    /// MERGE_BATCH_ROWS rows at a time, so the resolve path never waits for
+    /// a whole flush.
+    void start_flusher(int32_t interval_ms);
+    /// Stop the background flusher. Rows it hasn't written are left for
+    /// the next merge.
+    void stop_flusher();
+    /// Copy on-disk hits to the in-mem cache in a background thread, so a
+    /// lookup returns as soon as the on-disk row is read. Until this is
+    /// called, hits are copied by the lookup itself.
+    ///
+    /// @param prefetch_neighbors
+    ///  Also copy this many on-disk records that follow each hit in
+    ///  hostname order, if the policy admits them. Useful when names are
+    ///  requested in sequence.
+    void start_promoter(int32_t prefetch_neighbors);
+    /// Copy the hits still queued, then stop the promotion worker.
+    void stop_promoter();
+    /// Delete expired records in a background thread every @a interval_ms.
+    /// Each hold of the connection deletes at most SWEEP_BATCH records, so
+    /// a sweep never makes lookups or writers wait for long. Expired
+    /// records the sweep hasn't reached yet are deleted when read.
+    void start_sweeper(int32_t interval_ms);
+    /// Stop the background sweeper.
+    void stop_sweeper();
+    /// Print hit ratio of each cache tier
+    void print_cache_stats() const;
+    /// Counts of lookups that missed both tiers
+    resolver_stats_t resolver_stats() const;
+    /// Number of records in cache @a ctype
+    int64_t cache_size(cache_type_t ctype) const { return cache_sizes[ctype]; }
 private:
-    int sdb_put_into_cache(cache_type_t ctype, storage::data::Row& data);
+    /// DNS lookup of a name that missed both caches, shared by all
+    /// requests for that name while it is in flight
+    struct flight_t
+    {
+        example_event done;
+        int rc;
+        std::string ip;
+
+        flight_t() : done(false), rc(DB_FAILURE) {}
+    };
+
+    /// Search in-mem, then on-disk cache through the borrowed connection
+    /// @a conn
+    int sdb_lookup_cache(example_connection_pool::lease& conn, const std::string& hostname,
+                         storage::data::Row& cache_row);
+    /// Resolve a name that missed both caches, joining a request in flight
+    int resolve_upstream(const std::string& hostname, std::string& ip);
+    /// Check the negative cache; flight_mutex must be held.
+    bool is_negative_(const std::string& hostname);
+    /// Add to the negative cache; flight_mutex must be held.
+    void add_negative_(const std::string& hostname);
+
+    /// Insert a record, to be committed by group_commit; db_mutex must be
+    /// held. The ticket of the write is stored in @a ticket if not NULL.
+    int sdb_put_into_cache(cache_type_t ctype, storage::data::Row& data, int64_t * ticket = NULL);
     /// Search requested cache type for hostname and update statistics, if found.        
-    int sdb_search_cache(cache_type_t ctype, const std::string& hostname, storage::data::Row& result);
-    int sdb_shape_cache(cache_type_t ctype);
+    int sdb_search_cache(example_connection_pool::lease& conn, cache_type_t ctype,
+                         const std::string& hostname, storage::data::Row& result);
+    /// Next age from age_seq
+    int next_age_(int64_t& age);
+    /// Delete the oldest records of @a ctype; the number deleted is added
+    /// to @a deleted if not NULL.
+    int sdb_shape_cache(cache_type_t ctype, int64_t * deleted = NULL);
+    /// Delete in-mem records chosen by mem_policy. Records a lookup has
+    /// already deleted are skipped. The names of the records deleted here
+    /// are appended to @a evicted, and on error the names not reached to
+    /// @a not_evicted, if not NULL.
+    int sdb_evict_mem(const std::vector<std::string>& hostnames,
+                      std::vector<std::string> * evicted = NULL,
+                      std::vector<std::string> * not_evicted = NULL);
+    /// Revert the counters and mem_policy after the commit of a write by
+    /// sdb_put_into_cache() failed; db_mutex must be held.
+    void undo_put_(cache_type_t ctype, const std::string& hostname,
+                   const std::vector<std::string>& evicted, int64_t deleted);
+    /// Revert the counters and mem_policy after the commit of records
+    /// deleted by sdb_sweep_expired(), or evicted for an insert that
+    /// failed, failed; db_mutex must be held.
+    void undo_deletes_(cache_type_t ctype, const std::vector<std::string>& names, int64_t deleted);
+    /// Remember the new values of an in-mem row
+    void mark_dirty_(const std::string& hostname, storage::data::Row& row);
+    /// Move dirty_rows to flushing_rows; db_mutex must be held.
+    void take_dirty_rows_();
+    /// Update or insert the first MERGE_BATCH_ROWS of @a rows into
+    /// hosts_dsk in one transaction, and remove them from @a rows if it
+    /// commits; db_mutex must be held.
+    int sdb_write_back_batch(dirty_rows_t& rows, int& upd_cnt, int& ins_cnt);
+    static void flusher_proc(void * arg);
+
+    /// Queue a copy of the on-disk hit @a row
+    void queue_promotion_(const std::string& hostname, storage::data::Row& row);
+    /// Copy a queued hit and its neighbors to the in-mem cache; db_mutex
+    /// must be held.
+    int sdb_promote(const promotion_t& promotion);
+    /// Open mem_by_name if not open yet; db_mutex must be held.
+    int open_mem_by_name_();
+    /// Look up @a hostname in the in-mem cache without counting a hit.
+    int sdb_find_mem(const std::string& hostname, bool& found);
+    static void promoter_proc(void * arg);
+
+    /// Delete up to SWEEP_BATCH expired records from cache @a ctype in the
+    /// order they expired; db_mutex must be held.
+    int sdb_sweep_expired(cache_type_t ctype, int& deleted);
+    static void sweeper_proc(void * arg);
 
 private:
+    /// Connection of the writers: DNS answers, promotions and flushes
     storage::ittiadb::Connection& db;
+    /// Connections borrowed by lookups, with their tables kept open
+    example_connection_pool lookup_connections;
+    /// Connection of age_seq alone, so any resolver can take an age
+    /// without waiting for db_mutex
+    storage::ittiadb::Connection age_db;
+    /// Ages handed out locally from blocks of age_seq; guarded by age_mutex
+    SequenceBlockAllocator age_seq;
+    std::mutex age_mutex;
+    example_cache_policy& mem_policy;
+    /// Guards mem_policy
+    std::mutex policy_mutex;
+    /// 'hosts_mem' on hosts_pkey, kept open for the promotion worker
+    storage::ittiadb::Table mem_by_name;
+    bool mem_by_name_open;
+    /// Caches sizes. - To monitor if cache should be shaped a bit
+    std::atomic<int64_t> cache_sizes[CT_GUARD];
+    tier_stats_t tier_stats[CT_GUARD];
+    std::atomic<int64_t> admissions;
+    std::atomic<int64_t> rejections;
+    int64_t evictions;
+    /// In-mem rows changed since the last merge. Evicted rows stay here
+    /// until they are written, so no change is lost with the row. Guarded
+    /// by dirty_mutex.
+    dirty_rows_t dirty_rows;
+    std::mutex dirty_mutex;
+    /// Rows taken from dirty_rows to be written. Values in dirty_rows are
+    /// newer, so they are written after these.
+    dirty_rows_t flushing_rows;
+    int64_t flushed_rows;
+    int64_t warmup_rows;
+    int64_t warmup_ms;
+
+    std::unique_ptr<example_thread> flusher;
+    example_event flusher_stop;
+    int32_t flush_interval_ms;
+
+    example_task_queue<promotion_t> promotions;
+    std::unique_ptr<example_thread> promoter;
+    example_event promoter_wake;
+    example_event promoter_stop;
+    int32_t prefetch_neighbors;
+    std::atomic<int64_t> promotions_queued;
+    std::atomic<int64_t> promotions_dropped;
+    int64_t prefetched;
+
+    std::unique_ptr<example_thread> sweeper;
+    example_event sweeper_stop;
+    int32_t sweep_interval_ms;
+    int64_t swept;
+    std::atomic<int64_t> expired_on_read;
+
+    /// Serializes use of db, flushing_rows and the plain counters above.
+    /// age_mutex, policy_mutex and dirty_mutex may be taken while it is
+    /// held, but not the other way around.
+    mutable std::mutex db_mutex;
+    /// Commits the writes made on db
+    GroupCommit group_commit;
+    /// Guards in_flight, negative_cache and resolver_stats_
+    mutable std::mutex flight_mutex;
+    std::unordered_map<std::string, std::shared_ptr<flight_t> > in_flight;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> negative_cache;
+    resolver_stats_t resolver_stats_;
 };
 /// Example Data generators 
 /// Emulate DNS-server side for our example
@@ -112,11 +478,40 @@ class DataGenerator
 public:
     /// Generate names of form "host_a".."host_z", "host_aa".."host_zz"
     static void generate_hostname(char *hname);
+    /// Pick one of the popular names "www_0".."www_149", lower numbers
+    /// more often, drawn from the caller's random @a seed
+    static void generate_popular_hostname(uint32_t& seed, char *hname);
+    /// Mix of popular, long tail and unresolvable names for the concurrent
+    /// client driver, drawn from the caller's random @a seed
+    static void generate_request_hostname(uint32_t& seed, char *hname);
     /// For simplicity of our example, suppose dns request has always successfull result, and each request
-    /// always returns different ip - addreses if even hostname is the same.
-    static void do_dns_server_request(const std::string& hostname, std::string& ip);
+    /// always returns different ip - addreses if even hostname is the same. Only names starting
+    /// with "nx_" don't exist, and DB_ENOTFOUND is returned for them. The answer may be cached
+    /// for @a ttl_ms.
+    static int do_dns_server_request(const std::string& hostname, std::string& ip, int32_t& ttl_ms);
+    /// Emulated round trip of each DNS request
+    static std::atomic<int32_t> upstream_latency_ms;
+};
+
+std::atomic<int32_t> DataGenerator::upstream_latency_ms(0);
+
+/// Arguments and results of one thread of the concurrent client driver
+struct client_thread_t
+{
+    ManageHybridDatabase * mhd;
+    uint32_t seed;
+    int rc;
+    std::vector<int64_t> latencies_us;
 };
 
+/// Resolve names from @a thread_count threads at once and report DNS
+/// requests saved, lookup latency and @a requests_per_second
+static int run_concurrent_clients(ManageHybridDatabase& mhd, int thread_count, double& requests_per_second);
+
+/// Run the concurrent clients with 1, 2, 4, ... and @a max_threads threads
+/// and report how the throughput scales
+static int run_scaling_benchmark(ManageHybridDatabase& mhd, int max_threads);
+
 int
 example_main(int argc, char *argv[])
 {
@@ -128,6 +523,21 @@ example_main(int argc, char *argv[])
     if (argc > 1) {
         database_uri = argv[1];
     }
+    // In-mem cache replacement policy: lru, 2q, arc, optionally +tinylfu
+    const char * policy_name = argc > 2 ? argv[2] : "lru";
+    // Most client threads of the scaling benchmark, which runs instead of
+    // the single client if given
+    const int client_threads = argc > 3 ? atoi(argv[3]) : 0;
+    // Background flush interval of in-mem changes; 0 writes them at exit only
+    const int32_t flush_interval_ms = argc > 4 ? atoi(argv[4]) : FLUSH_INTERVAL_MS;
+    // Records following each on-disk hit to prefetch into the in-mem cache
+    const int32_t prefetch_neighbors = argc > 5 ? atoi(argv[5]) : 0;
+    std::unique_ptr<example_cache_policy> mem_policy(
+        example_make_cache_policy(policy_name, (size_t)cache_size_limits[IN_MEM]));
+    if (!mem_policy) {
+        std::cerr << "Unknown cache policy " << policy_name << std::endl;
+        return EXIT_FAILURE;
+    }
 
     storage::ittiadb::Connection database(database_uri);
 
@@ -141,6 +551,25 @@ example_main(int argc, char *argv[])
     db_rc = database.open(storage::ittiadb::Connection::OpenAlways, file_storage_config);
     GET_ECODE(rc, db_rc, "Failed to open database ");
 
+    //Caches created before records expired have no expires column. They
+    //only hold cached answers, so they are dropped and created again.
+    static const char * const cache_tables[] = { "hosts_dsk", "hosts_mem" };
+    for (int t = 0; t < CT_GUARD && DB_NOERROR == rc; ++t) {
+        storage::ittiadb::Table table(database, cache_tables[t]);
+        if (!table.exists()) {
+            continue;
+        }
+        if (DB_OK == table.open("hosts_expires_idx")) {
+            (void)table.close();
+        }
+        else {
+            std::string drop_table("DROP TABLE ");
+            drop_table += cache_tables[t];
+            rows_affected = storage::ittiadb::Query(database, drop_table.c_str()).execute();
+            GET_ECODE(rc, rows_affected, "Drop cache table without expiry ");
+        }
+    }
+
     //Create hosts disk table
     if ((DB_NOERROR == rc) 
         && (false == storage::ittiadb::Table(database,"hosts_dsk").exists())) {
@@ -151,6 +580,7 @@ example_main(int argc, char *argv[])
             "hostip ansistr(16) NOT NULL,"
             "requestcount sint32 NOT NULL,"
             "age sint64 NULL,"
+            "expires sint64 NOT NULL,"
             "CONSTRAINT hosts_pkey PRIMARY KEY(hostname))"
             ).execute();
 
@@ -164,8 +594,46 @@ example_main(int argc, char *argv[])
 
             GET_ECODE(rc, rows_affected, "Create host_age_idx index to'hosts_dsk' table ");
         }
+        //Create index of expiry times for the sweeper
+        if (DB_NOERROR == rc)
+        {
+            rows_affected = storage::ittiadb::Query(database,
+                "CREATE INDEX hosts_expires_idx ON hosts_dsk (expires)"
+                ).execute();
+
+            GET_ECODE(rc, rows_affected, "Create hosts_expires_idx index to'hosts_dsk' table ");
+        }
+    }
+
+    //Create index of the hottest records for the in-mem cache warm-up. The
+    //hostname makes every key unique, so the index can be walked key by key.
+    if (DB_NOERROR == rc) {
+        storage::ittiadb::Table t_dsk(database, "hosts_dsk");
+        if (DB_OK == t_dsk.open("hosts_hot_idx")) {
+            (void)t_dsk.close();
+        }
+        else {
+            rows_affected = storage::ittiadb::Query(database,
+                "CREATE INDEX hosts_hot_idx ON hosts_dsk (requestcount, age, hostname)"
+                ).execute();
+
+            GET_ECODE(rc, rows_affected, "Create hosts_hot_idx index to'hosts_dsk' table ");
+        }
     }
     
+    //Create table of row counts saved at a clean shutdown
+    if (DB_NOERROR == rc
+        && (false == storage::ittiadb::Table(database, "cache_row_counts").exists())) {
+        rows_affected = storage::ittiadb::Query(database,
+            "CREATE TABLE cache_row_counts("
+            "tablename ansistr(16) NOT NULL,"
+            "rowcount sint64 NOT NULL,"
+            "CONSTRAINT cache_row_counts_pkey PRIMARY KEY(tablename))"
+            ).execute();
+
+        GET_ECODE(rc, rows_affected, "Create 'cache_row_counts' table ");
+    }
+
     //Create hosts memory table
     if (DB_NOERROR == rc 
         && (false == storage::ittiadb::Table(database, "hosts_mem").exists())) {
@@ -175,6 +643,7 @@ example_main(int argc, char *argv[])
             "hostip ansistr(16) NOT NULL,"
             "requestcount sint32 NOT NULL,"
             "age sint64 NULL,"
+            "expires sint64 NOT NULL,"
             "CONSTRAINT hosts_pkey PRIMARY KEY(hostname))"
             ).execute();
 
@@ -188,37 +657,74 @@ example_main(int argc, char *argv[])
 
             GET_ECODE(rc, rows_affected, "Create host_age_idx index to'hosts_mem' table ");
         }
+        if (DB_NOERROR == rc)
+        {
+            rows_affected = storage::ittiadb::Query(database,
+                "CREATE INDEX hosts_expires_idx ON hosts_mem (expires)"
+                ).execute();
+
+            GET_ECODE(rc, rows_affected, "Create hosts_expires_idx index to'hosts_mem' table ");
+        }
     }
 
     if (DB_NOERROR == rc)
     {
-        ManageHybridDatabase mhd(database);
+        ManageHybridDatabase mhd(database, database_uri, *mem_policy);
         rc = mhd.sdb_copy_disk_to_mem_cache();
 
         // Create Sequence
         if (DB_NOERROR == rc)
         {
-            rows_affected = storage::ittiadb::Query(database,
-                "CREATE SEQUENCE age_seq START WITH 1").execute();
+            char create_sequence[100];
+            sprintf(create_sequence, "CREATE SEQUENCE age_seq START WITH 1 INCREMENT BY %d", (int)AGE_SEQ_BLOCK);
+            rows_affected = storage::ittiadb::Query(database, create_sequence).execute();
             GET_ECODE(rc, rows_affected, "Create age_seq sequence ");
         }
 
+        if (DB_NOERROR == rc && flush_interval_ms > 0) {
+            mhd.start_flusher(flush_interval_ms);
+        }
+        if (DB_NOERROR == rc) {
+            mhd.start_promoter(prefetch_neighbors);
+            mhd.start_sweeper(SWEEP_INTERVAL_MS);
+        }
+
         int i = 0;
+        if (DB_NOERROR == rc && client_threads > 0) {
+            rc = run_scaling_benchmark(mhd, client_threads);
+            i = CLIENT_REQUESTS;
+        }
         // Emulate clients' requests
+        uint32_t popular_seed = 1;
         for (; i < CLIENT_REQUESTS && (DB_NOERROR == rc); ++i) {
             char hostname[MAX_HOSTNAME_LEN + 1]="";
             //char ip[MAX_IP_LEN + 1];
             std::string ip;
-            DataGenerator::generate_hostname(hostname);
+            // Three of four requests go to popular hosts, the rest scan
+            // the long tail
+            if (i % 4) {
+                DataGenerator::generate_popular_hostname(popular_seed, hostname);
+            }
+            else {
+                DataGenerator::generate_hostname(hostname);
+            }
 
             rc = mhd.resolve_ip_by_hostname(hostname, ip);
 
-            std::cout << i << ". Hostname: " << hostname << ", ip: " << ip <<
-                ", cache_sizes(" << cache_sizes[IN_MEM] << "," << cache_sizes[ON_DISK]
-                << ") rc:" << rc << std::endl;
+            EXAMPLE_LOG_DEBUG(i << ". Hostname: " << hostname << ", ip: " << ip <<
+                ", cache_sizes(" << mhd.cache_size(IN_MEM) << "," << mhd.cache_size(ON_DISK)
+                << ") rc:" << rc);
         }
 
+        mhd.stop_sweeper();
+        mhd.stop_promoter();
+        mhd.stop_flusher();
         rc = mhd.sdb_merge_mem_cache_to_disk();
+        if (DB_NOERROR == rc) {
+            rc = mhd.sdb_save_disk_row_count();
+        }
+        example_log_flush();
+        mhd.print_cache_stats();
 
         // Commit the transaction if active and no error
         if (DB_NOERROR == rc && storage::ittiadb::Transaction(database).isActive())
@@ -235,7 +741,7 @@ example_main(int argc, char *argv[])
     }
     else
     {
-        std::cerr << "Couldn't load in-mem cache data" <<std::endl;
+        EXAMPLE_LOG_ERROR("Couldn't load in-mem cache data");
     }
 
     if (DB_NOERROR != rc)
@@ -243,6 +749,7 @@ example_main(int argc, char *argv[])
         database.close();
     }
 
+    example_log_flush();
     std::cout << "Enter SQL statements or an empty line to exit" << std::endl;
     sql_line_shell(database);
 
@@ -252,260 +759,1234 @@ example_main(int argc, char *argv[])
 void
 DataGenerator::generate_hostname(char *hname)
 {
-    int i = 0;
-    static int hidx = 0;
-    int hidx_cur;
-    int suffix_len = 1;
-
-    hidx %= EMULATE_HOSTSNAMES_COUNT;
-
-    if ((int)(hidx / 26 / 26)) {
-        hidx = 0;
-        suffix_len = 1;
-    }
-    else if ((int)(hidx / 26)) {
-        suffix_len = 2;
-    }
-    else {
-        suffix_len = 1;
-    }
+    static std::atomic<uint32_t> hidx(0);
+    const int hidx_cur = (int)(hidx++ % EMULATE_HOSTSNAMES_COUNT);
+    const int suffix_len = hidx_cur / 26 ? 2 : 1;
 
     strncpy(hname, "host_", MAX_HOSTNAME_LEN);
 
-    hidx_cur = hidx++;
-    for (; i < suffix_len; ++i, hidx_cur /= 26) {
-        hname[5 + i] = 65 + hidx_cur % 26;
+    int n = hidx_cur;
+    for (int i = 0; i < suffix_len; ++i, n /= 26) {
+        hname[5 + i] = 65 + n % 26;
     }
     hname[5 + suffix_len] = 0;
 }
 
 void
-DataGenerator::do_dns_server_request(const std::string& hostname, std::string& ip)
+DataGenerator::generate_popular_hostname(uint32_t& seed, char *hname)
+{
+    seed = seed * 1103515245 + 12345;
+    // Square of a uniform value in [0, 1): skewed towards low numbers
+    const double u = ((seed >> 16) & 0x7fff) / 32768.0;
+    sprintf(hname, "www_%d", (int)(u * u * POPULAR_HOSTNAMES_COUNT));
+}
+
+void
+DataGenerator::generate_request_hostname(uint32_t& seed, char *hname)
+{
+    seed = seed * 1103515245 + 12345;
+    const uint32_t kind = (seed >> 16) % 20;
+    seed = seed * 1103515245 + 12345;
+    const double u = ((seed >> 16) & 0x7fff) / 32768.0;
+
+    if (kind == 0) {
+        // One in 20 names doesn't exist
+        sprintf(hname, "nx_%d", (int)(u * 50));
+    }
+    else if (kind < 15) {
+        sprintf(hname, "www_%d", (int)(u * u * POPULAR_HOSTNAMES_COUNT));
+    }
+    else {
+        sprintf(hname, "host_%d", (int)(u * EMULATE_HOSTSNAMES_COUNT));
+    }
+}
+
+int
+DataGenerator::do_dns_server_request(const std::string& hostname, std::string& ip, int32_t& ttl_ms)
 {
-    static int ip_idx = 0;
+    static std::atomic<int> ip_idx(0);
+    const int32_t latency_ms = upstream_latency_ms.load();
+    if (latency_ms > 0) {
+        example_thread::sleep_for_milliseconds(latency_ms);
+    }
+    if (0 == hostname.compare(0, 3, "nx_")) {
+        return DB_ENOTFOUND;
+    }
+
+    const int n = ++ip_idx;
     std::ostringstream ss;
     ss  << 192
-        << "." << (168 + ip_idx++ % 80) 
-        << "." << (250 - ip_idx % 242) 
-        << "." << (1 + ip_idx % 250);
+        << "." << (168 + (n - 1) % 80) 
+        << "." << (250 - n % 242) 
+        << "." << (1 + n % 250);
    // strncpy(ip, ss.str().c_str(), MAX_IP_LEN);
     ip = ss.str();
+    ttl_ms = DNS_TTL_MS;
+    return DB_NOERROR;
 }
 
-ManageHybridDatabase::ManageHybridDatabase(storage::ittiadb::Connection& database)
-    :db(database)
+GroupCommit::GroupCommit(storage::ittiadb::Connection& database, std::mutex& db_mutex,
+                         int64_t max_batch, int32_t max_delay_ms)
+    : db(database)
+    , db_mutex(db_mutex)
+    , max_batch(max_batch < 1 ? 1 : max_batch)
+    , max_delay(max_delay_ms)
+    , written(0)
+    , committed(0)
+    , first_pending()
+    , failed()
+    , pending_undo()
+    , commits(0)
+    , stopping(false)
+    , committer(new example_thread(committer_proc, this))
 {
-    //Empty
 }
 
-ManageHybridDatabase::~ManageHybridDatabase()
+GroupCommit::~GroupCommit()
 {
-    //Empty
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    pending_cv.notify_all();
+    committer->join();
+
+    std::lock_guard<std::mutex> db_lock(db_mutex);
+    (void)commit_locked();
 }
 
-int
-ManageHybridDatabase::resolve_ip_by_hostname(const std::string& hostname, std::string& ip)
+int64_t
+GroupCommit::add_write_locked(const undo_t& undo)
 {
-    int rc = DB_FAILURE;    
-    storage::data::SingleRow cache_row(storage::ittiadb::Table(db, "hosts_dsk").columns());
+    int64_t ticket;
+    bool full;
+    if (undo) {
+        pending_undo.push_back(undo);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ticket = ++written;
+        if (written - committed == 1) {
+            // First write of a batch: start the delay
+            first_pending = std::chrono::steady_clock::now();
+            pending_cv.notify_one();
+        }
+        full = written - committed >= max_batch;
+    }
+    if (full) {
+        (void)commit_locked();
+    }
+    return ticket;
+}
 
-    // Search in-mem cahce. Searching in-mem cache automatically increase 
-    // in-mem statistics (age & requests count)
-    rc = sdb_search_cache(IN_MEM, hostname, cache_row);
+int
+GroupCommit::commit_locked()
+{
+    int rc = DB_NOERROR;
+    int64_t from;
+    int64_t upto;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        from = committed;
+        upto = written;
+    }
+    if (from == upto) {
+        return rc;
+    }
 
-    if (DB_NOERROR != rc) {
-        if (rc == DB_ENOTFOUND) {
-            rc = sdb_search_cache(ON_DISK, hostname, cache_row);
+    std::vector<undo_t> undo;
+    undo.swap(pending_undo);
+    storage::ittiadb::Transaction txn(db);
+    db_result_t db_rc = txn.commit();
+    GET_ECODE(rc, db_rc, "Group commit ");
+    if (DB_NOERROR != rc && txn.isActive()) {
+        (void)txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+    }
 
-            if (DB_NOERROR == rc) {
-                // If on-disk cache contains data requested, copy this record to
-                // in-mem cache for late usage by clients
-                sdb_put_into_cache(IN_MEM, cache_row);
-            }
-            else if (DB_ENOTFOUND == rc) {
-                DataGenerator::do_dns_server_request(hostname, ip);
-                cache_row["hostname"].set(hostname);
-                cache_row["hostip"].set(ip);
-                cache_row["requestcount"].set(1);
-                storage::data::SingleField next_seq_field;
-                storage::ittiadb::Query(db, 
-                    "SELECT NEXT VALUE FOR age_seq").execute(next_seq_field);
-                int64_t next_seq_value;
-                next_seq_field.get(next_seq_value);
-                cache_row["age"].set(next_seq_value);                 
-                rc = sdb_put_into_cache(ON_DISK, cache_row);
-            }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        committed = upto;
+        ++commits;
+        if (DB_NOERROR != rc) {
+            failed_range_t range = { from, upto, rc };
+            failed.push_back(range);
         }
     }
-
-    if (DB_NOERROR == rc) {
-        cache_row["hostip"].get(ip);
+    if (DB_NOERROR != rc) {
+        // Newest first, the reverse of the order the changes were made
+        for (std::vector<undo_t>::reverse_iterator iter = undo.rbegin(); iter != undo.rend(); ++iter) {
+            (*iter)();
+        }
     }
+    committed_cv.notify_all();
     return rc;
 }
 
 int
-ManageHybridDatabase::sdb_copy_disk_to_mem_cache()
+GroupCommit::wait_durable(int64_t ticket)
 {
-    int rc = DB_NOERROR;
-    db_result_t db_rc = DB_OK;
-    int64_t count2cpy = cache_sizes[IN_MEM];
-    storage::ittiadb::Table t_dsk(db, "hosts_dsk");
-    storage::ittiadb::Table t_mem(db, "hosts_mem");
-    //Open Hosts disk table
-    db_rc = t_dsk.open("hosts_age_idx", storage::ittiadb::Table::Exclusive);
-    GET_ECODE(rc, db_rc, "Open hosts_dsk table ");
-    storage::data::RowSet<> rows_dsk(t_dsk.columns());
-    if (DB_NOERROR == rc)
-    {
-        db_rc = t_dsk.fetch(rows_dsk);
-        GET_ECODE(rc, db_rc, "Fetch row set from hosts_dsk table ");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (committed < ticket) {
+        committed_cv.wait(lock);
     }
-    if (DB_NOERROR == rc) {
-        // Open hosts memory table
-        db_rc = t_mem.open(storage::ittiadb::Table::Exclusive);
-        GET_ECODE(rc, db_rc, "Open hosts_mem table ");
-        //Copy fetched disk rows to memory table
-        storage::data::RowSet<>::iterator itr = rows_dsk.begin();
-        for (; (itr != rows_dsk.end()) && (DB_OK == db_rc); ++itr)
-        {
-            ++cache_sizes[ON_DISK];
-            if (--count2cpy > 0)
-            {
-                db_rc = t_mem.insert(*itr);
-                if (DB_OK == db_rc)
-                {
-                    ++cache_sizes[IN_MEM];
-                }
-            }
+    // Recent tickets are the ones usually waited for, so search from the end
+    for (std::vector<failed_range_t>::reverse_iterator iter = failed.rbegin(); iter != failed.rend(); ++iter) {
+        if (ticket > iter->to) {
+            break;
+        }
+        if (ticket > iter->from) {
+            return iter->rc;
         }
-        GET_ECODE(rc, db_rc, "while copying from on-disk to in-mem caches ");
     }
+    return DB_NOERROR;
+}
 
-    return rc;
+void
+GroupCommit::statistics(int64_t& commits, int64_t& writes) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    commits = this->commits;
+    writes = committed;
 }
 
-int
-ManageHybridDatabase::sdb_merge_mem_cache_to_disk()
+void
+GroupCommit::committer_proc(void * arg)
+{
+    GroupCommit * gc = static_cast<GroupCommit *>(arg);
+    std::unique_lock<std::mutex> lock(gc->mutex);
+    while (!gc->stopping) {
+        if (gc->written == gc->committed) {
+            gc->pending_cv.wait(lock);
+            continue;
+        }
+        const std::chrono::steady_clock::time_point deadline = gc->first_pending + gc->max_delay;
+        if (std::chrono::steady_clock::now() < deadline) {
+            gc->pending_cv.wait_until(lock, deadline);
+            continue;
+        }
+        // The oldest write waited long enough: commit what is pending,
+        // unless a full batch got committed meanwhile
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> db_lock(gc->db_mutex);
+            (void)gc->commit_locked();
+        }
+        lock.lock();
+    }
+}
+
+ManageHybridDatabase::ManageHybridDatabase(storage::ittiadb::Connection& database,
+                                           const char * database_uri,
+                                           example_cache_policy& mem_policy)
+    :db(database)
+    , lookup_connections(database_uri, 1, LOOKUP_CONNECTIONS)
+    , age_db(database_uri)
+    , age_seq(age_db, "age_seq", AGE_SEQ_BLOCK)
+    , mem_policy(mem_policy)
+    , mem_by_name(database, "hosts_mem")
+    , mem_by_name_open(false)
+    , admissions(0)
+    , rejections(0)
+    , evictions(0)
+    , flushed_rows(0)
+    , warmup_rows(0)
+    , warmup_ms(0)
+    , flusher_stop(false)
+    , flush_interval_ms(0)
+    , promotions(PROMOTION_QUEUE_SIZE)
+    , promoter_wake(true)
+    , promoter_stop(false)
+    , prefetch_neighbors(0)
+    , promotions_queued(0)
+    , promotions_dropped(0)
+    , prefetched(0)
+    , sweeper_stop(false)
+    , sweep_interval_ms(0)
+    , swept(0)
+    , expired_on_read(0)
+    , group_commit(database, db_mutex, GROUP_COMMIT_MAX_BATCH, GROUP_COMMIT_MAX_DELAY_MS)
 {
     int rc = DB_NOERROR;
-    db_result_t db_rc = DB_OK;
-    int upd_cnt = 0;
-    int ins_cnt = 0;
+    GET_ECODE(rc, age_db.open(storage::ittiadb::Connection::OpenExisting), "Open age_seq connection ");
 
-    storage::ittiadb::Table t_dsk(db, "hosts_dsk");
-    storage::ittiadb::Table t_mem(db, "hosts_mem");
-    db_rc = t_mem.open("hosts_age_idx", storage::ittiadb::Table::Exclusive);
-    GET_ECODE(rc, db_rc, "Open hosts_mem table with hosts_age_idx: ");
-    storage::data::RowSet<> rows_mem(t_mem.columns());
-    if (DB_NOERROR == rc)
-    {
-        db_rc = t_mem.fetch(rows_mem);
-        GET_ECODE(rc, db_rc, "Fetching rowset from hosts-mem table ");
+    resolver_stats_.upstream_calls = 0;
+    resolver_stats_.coalesced = 0;
+    resolver_stats_.negative_hits = 0;
+    for (int i = 0; i < CT_GUARD; ++i) {
+        cache_sizes[i] = 0;
+        tier_stats[i].lookups = 0;
+        tier_stats[i].hits = 0;
     }
-    if (DB_NOERROR == rc)
+}
+
+ManageHybridDatabase::~ManageHybridDatabase()
+{
+    stop_sweeper();
+    stop_promoter();
+    stop_flusher();
+    if (mem_by_name_open) {
+        (void)mem_by_name.close();
+    }
+}
+
+int
+ManageHybridDatabase::resolve_ip_by_hostname(const std::string& hostname, std::string& ip)
+{
+    int rc = DB_FAILURE;    
     {
-        //Open disk table
-        db_rc = t_dsk.open("hosts_pkey", storage::ittiadb::Table::Exclusive);
-        GET_ECODE(rc, db_rc, "Opening hosts_dsk table with hosts_pkey: ");
+        std::lock_guard<std::mutex> lock(flight_mutex);
+        if (is_negative_(hostname)) {
+            return DB_ENOTFOUND;
+        }
     }
-    //Copy fetched mem rows to disk table
-    storage::data::RowSet<>::iterator itr = rows_mem.begin();
-    storage::data::SingleRow single_row(t_dsk.columns());
-    for (; (itr != rows_mem.end()) && (DB_NOERROR == rc); ++itr)
-    {        
-        db_rc = t_dsk.search_by_index(DB_SEEK_FIRST_EQUAL, *itr, single_row);
-        GET_ECODE(rc, db_rc, NULL);
-        if (DB_NOERROR == rc)
-        {
-            db_rc = t_dsk.update_by_index(single_row, *itr);
-            GET_ECODE(rc, db_rc, "Udating from in-mem to on-disk  ");
-            upd_cnt++;
+    {
+        example_connection_pool::lease conn(lookup_connections);
+        if (!conn.valid()) {
+            EXAMPLE_LOG_ERROR("No connection for lookup :: " << storage::data::Environment::error());
+            return storage::data::Environment::error().code;
+        }
+        storage::data::SingleRow cache_row(storage::ittiadb::Table(conn.connection(), "hosts_dsk").columns());
+        rc = sdb_lookup_cache(conn, hostname, cache_row);
+        if (DB_NOERROR == rc) {
+            cache_row["hostip"].get(ip);
         }
-        else if (DB_ENOTFOUND == rc)
-        {
-            db_rc = t_dsk.insert(*itr);
-            GET_ECODE(rc, db_rc, "Inserting from in-mem to on-disk  ");
-            ins_cnt++;
-        }        
     }
-    std::cout << "Mem->Disk merge result (error_code, inmem_size, inserted, updated): ("
-        << rc << "," << rows_mem.size() << "," << ins_cnt << "," << upd_cnt << ")" << std::endl;
+    if (DB_ENOTFOUND == rc) {
+        rc = resolve_upstream(hostname, ip);
+    }
     return rc;
 }
 
 int
-ManageHybridDatabase::sdb_put_into_cache(cache_type_t ctype, storage::data::Row& data)
+ManageHybridDatabase::sdb_lookup_cache(example_connection_pool::lease& conn, const std::string& hostname,
+                                       storage::data::Row& cache_row)
 {
-    int rc = DB_NOERROR;
-    db_result_t db_rc=DB_OK;
-    const char * table_name = (ctype == IN_MEM) ? "hosts_mem" : "hosts_dsk";
-    if (cache_sizes[ctype] > cache_size_limits[ctype]) {
-        (void)sdb_shape_cache(ctype);
+    // Search in-mem cahce. Searching in-mem cache automatically increase 
+    // in-mem statistics (age & requests count)
+    int rc = sdb_search_cache(conn, IN_MEM, hostname, cache_row);
+    ++tier_stats[IN_MEM].lookups;
+
+    if (DB_NOERROR == rc) {
+        ++tier_stats[IN_MEM].hits;
+        std::lock_guard<std::mutex> lock(policy_mutex);
+        mem_policy.on_hit(hostname);
     }
-    storage::ittiadb::Table table(db,table_name);
-    db_rc = table.open(storage::ittiadb::Table::Exclusive);
-    GET_ECODE(rc, db_rc, "sdb_put_into_cache: Open table ");
-    if (DB_NOERROR == rc)
-    {
-        db_rc = table.insert(data);
-        GET_ECODE(rc, db_rc, "sdb_put_into_cache: Couldn't put data into cache ");
-        if (DB_NOERROR == rc)
-        {
-            static int commits = 0;
-            cache_sizes[ctype]++;
-            if (ON_DISK == ctype && 0 == commits++ % 50) {
-                //commit transaction
-                storage::ittiadb::Transaction(db).commit();
+    else if (rc == DB_ENOTFOUND) {
+        rc = sdb_search_cache(conn, ON_DISK, hostname, cache_row);
+        ++tier_stats[ON_DISK].lookups;
+
+        if (DB_NOERROR == rc) {
+            ++tier_stats[ON_DISK].hits;
+            // If on-disk cache contains data requested, copy this record to
+            // in-mem cache for late usage by clients, unless the policy
+            // expects it to be less useful than what it would evict
+            bool admit;
+            {
+                std::lock_guard<std::mutex> lock(policy_mutex);
+                admit = mem_policy.admit(hostname);
+            }
+            if (admit) {
+                ++admissions;
+                if (promoter) {
+                    queue_promotion_(hostname, cache_row);
+                }
+                else {
+                    // Seen by other lookups after the group commit
+                    std::lock_guard<std::mutex> lock(db_mutex);
+                    sdb_put_into_cache(IN_MEM, cache_row);
+                }
             }
+            else {
+                ++rejections;
+            }
+        }
+    }
+
+    // Nothing is left open when the connection goes back to the pool. A
+    // failed step, e.g. a bump whose row couldn't be read back into the
+    // dirty rows, is rolled back rather than committed half done.
+    storage::ittiadb::Transaction txn(conn.connection());
+    if (txn.isActive()) {
+        if (DB_NOERROR == rc || DB_ENOTFOUND == rc) {
+            (void)txn.commit();
+        }
+        else {
+            (void)txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
         }
     }
     return rc;
 }
 
 int
-ManageHybridDatabase::sdb_search_cache(cache_type_t ctype, const std::string& hostname, storage::data::Row& result)
+ManageHybridDatabase::resolve_upstream(const std::string& hostname, std::string& ip)
 {
-    int rc = DB_NOERROR;
-    db_result_t db_rc = DB_OK;
-    const char * table_name = ctype == IN_MEM ? "hosts_mem" : "hosts_dsk";
-    storage::ittiadb::Table table(db, table_name);
-    db_rc = table.open("hosts_pkey", storage::ittiadb::Table::Exclusive);
-    GET_ECODE(rc, db_rc, "sdb_search_cache: Opening Table ");
-    storage::data::SingleRow key(table.columns());
-    key["hostname"].set(hostname.c_str());
-    if (DB_NOERROR == rc)
+    std::shared_ptr<flight_t> flight;
+    bool leader = false;
     {
-        db_rc = table.search_by_index(DB_SEEK_FIRST_EQUAL, key, 1,result);
-        GET_ECODE(rc, db_rc);
+        std::lock_guard<std::mutex> lock(flight_mutex);
+        std::unordered_map<std::string, std::shared_ptr<flight_t> >::iterator it = in_flight.find(hostname);
+        if (it != in_flight.end()) {
+            flight = it->second;
+            ++resolver_stats_.coalesced;
+        }
+        else {
+            flight = std::make_shared<flight_t>();
+            in_flight[hostname] = flight;
+            ++resolver_stats_.upstream_calls;
+            leader = true;
+        }
     }
-    if (DB_NOERROR == rc && ctype == IN_MEM)
+    if (!leader) {
+        // Another thread is asking the DNS server already
+        flight->done.wait();
+        ip = flight->ip;
+        return flight->rc;
+    }
+
+    // No lock is held during the DNS request
+    int32_t ttl_ms = 0;
+    int rc = DataGenerator::do_dns_server_request(hostname, ip, ttl_ms);
+    int64_t next_seq_value = 0;
+    if (DB_NOERROR == rc) {
+        rc = next_age_(next_seq_value);
+    }
+    int64_t ticket = 0;
+    if (DB_NOERROR == rc) {
+        std::lock_guard<std::mutex> lock(db_mutex);
+        storage::data::SingleRow cache_row(storage::ittiadb::Table(db, "hosts_dsk").columns());
+        cache_row["hostname"].set(hostname);
+        cache_row["hostip"].set(ip);
+        cache_row["requestcount"].set(1);
+        cache_row["age"].set(next_seq_value);
+        cache_row["expires"].set(now_ms() + ttl_ms);
+        rc = sdb_put_into_cache(ON_DISK, cache_row, &ticket);
+    }
+    if (DB_NOERROR == rc && WAIT_FOR_DURABLE_ANSWERS) {
+        // Requests that joined this flight get the answer once it is
+        // durable, too. No lock is held while waiting.
+        rc = group_commit.wait_durable(ticket);
+    }
+
+    flight->rc = rc;
+    flight->ip = ip;
     {
-        int32_t reqcount;
-        int64_t next_seq_value;
-        result["requestcount"].get(reqcount);
-        storage::data::SingleField next_seq_field;
-        storage::ittiadb::Query(db,
-            "SELECT NEXT VALUE FOR age_seq").execute(next_seq_field);        
-        next_seq_field.get(next_seq_value);
-        result["age"].set(next_seq_value);
-        db_rc = table.update_by_index(key, 1,result);
-        GET_ECODE(rc, db_rc, "Updating result row ");
+        std::lock_guard<std::mutex> lock(flight_mutex);
+        if (DB_ENOTFOUND == rc) {
+            add_negative_(hostname);
+        }
+        in_flight.erase(hostname);
     }
+    flight->done.set();
     return rc;
 }
 
-int
-ManageHybridDatabase::sdb_shape_cache(cache_type_t ctype)
+bool
+ManageHybridDatabase::is_negative_(const std::string& hostname)
 {
-    int rc = DB_NOERROR;
-    db_result_t db_rc = DB_OK;
-    const char * table_name = ctype == IN_MEM ? "hosts_mem" : "hosts_dsk";
-    int count2del = cache_del_chunks[ctype];
-    std::cout << "Delete " << count2del << " rows from " 
-        << (ctype == IN_MEM ? "IN-MEM" : "ON-DISK") << " cache" << std::endl;
-    storage::ittiadb::Table table(db, table_name);
-    db_rc = table.open("hosts_age_idx", storage::ittiadb::Table::Exclusive);
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point>::iterator it =
+        negative_cache.find(hostname);
+    if (it == negative_cache.end()) {
+        return false;
+    }
+    if (std::chrono::steady_clock::now() >= it->second) {
+        // Expired: ask the DNS server again
+        negative_cache.erase(it);
+        return false;
+    }
+    ++resolver_stats_.negative_hits;
+    return true;
+}
+
+void
+ManageHybridDatabase::add_negative_(const std::string& hostname)
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (negative_cache.size() >= NEGATIVE_CACHE_LIMIT) {
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point>::iterator it = negative_cache.begin();
+        while (it != negative_cache.end()) {
+            it = now >= it->second ? negative_cache.erase(it) : ++it;
+        }
+        if (negative_cache.size() >= NEGATIVE_CACHE_LIMIT) {
+            negative_cache.clear();
+        }
+    }
+    negative_cache[hostname] = now + std::chrono::milliseconds(NEGATIVE_TTL_MS);
+}
+
+resolver_stats_t
+ManageHybridDatabase::resolver_stats() const
+{
+    std::lock_guard<std::mutex> lock(flight_mutex);
+    return resolver_stats_;
+}
+
+int
+ManageHybridDatabase::sdb_copy_disk_to_mem_cache()
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc = DB_OK;
+    std::lock_guard<std::mutex> lock(db_mutex);
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    const int64_t count2cpy = (int64_t)mem_policy.capacity();
+
+    // The count saved at the last clean shutdown is removed once read, so
+    // after a crash there is none and the rows are counted instead
+    int64_t count = -1;
+    storage::ittiadb::Table saved_counts(db, "cache_row_counts");
+    if (DB_OK == saved_counts.open("cache_row_counts_pkey")) {
+        storage::data::SingleRow key(saved_counts.columns());
+        storage::data::SingleRow saved(saved_counts.columns());
+        key["tablename"].set("hosts_dsk");
+        if (DB_OK == saved_counts.search_by_index(DB_SEEK_FIRST_EQUAL, key, 1, saved)) {
+            saved["rowcount"].get(count);
+            db_rc = saved_counts.delete_by_index(key, 1);
+            GET_ECODE(rc, db_rc, "Remove saved hosts_dsk row count ");
+        }
+        (void)saved_counts.close();
+    }
+    if (DB_NOERROR == rc && count < 0) {
+        // COUNT(*) may visit every row, but only on the first start after
+        // a crash
+        storage::data::SingleField disk_rows;
+        db_rc = storage::ittiadb::Query(db, "SELECT COUNT(*) FROM hosts_dsk").execute(disk_rows);
+        GET_ECODE(rc, db_rc, "Count hosts_dsk rows ");
+        if (DB_NOERROR == rc) {
+            disk_rows.get(count);
+        }
+    }
+    if (DB_NOERROR == rc) {
+        cache_sizes[ON_DISK] = count;
+    }
+
+    storage::ittiadb::Transaction txn(db);
+    if (DB_NOERROR == rc && txn.isActive()) {
+        db_rc = txn.commit();
+        GET_ECODE(rc, db_rc, "Commit before warm-up ");
+    }
+    storage::ittiadb::Table t_dsk(db, "hosts_dsk");
+    storage::ittiadb::Table t_mem(db, "hosts_mem");
+    if (DB_NOERROR == rc) {
+        db_rc = t_dsk.open("hosts_hot_idx", storage::ittiadb::Table::Exclusive);
+        GET_ECODE(rc, db_rc, "Open hosts_dsk table ");
+    }
+    if (DB_NOERROR == rc) {
+        // Open hosts memory table
+        db_rc = t_mem.open(storage::ittiadb::Table::Exclusive);
+        GET_ECODE(rc, db_rc, "Open hosts_mem table ");
+    }
+    if (DB_NOERROR == rc) {
+        db_rc = txn.begin();
+        GET_ECODE(rc, db_rc, "Begin warm-up transaction ");
+    }
+
+    std::vector<std::string> loaded;
+    if (DB_NOERROR == rc && count2cpy > 0) {
+        storage::data::SingleRow row_a(t_dsk.columns());
+        storage::data::SingleRow row_b(t_dsk.columns());
+        storage::data::SingleRow * prev = &row_a;
+        storage::data::SingleRow * row = &row_b;
+
+        // Start at the last key and step down one key at a time
+        (*prev)["requestcount"].set(std::numeric_limits<int32_t>::max());
+        (*prev)["age"].set(std::numeric_limits<int64_t>::max());
+        const int64_t now = now_ms();
+        db_rc = t_dsk.search_by_index(DB_SEEK_LESS_OR_EQUAL, *prev, 2, *row);
+        while (DB_OK == db_rc) {
+            // Expired records are left to the sweeper
+            if (!is_expired(*row, now)) {
+                db_rc = t_mem.insert(*row);
+                if (DB_OK != db_rc) {
+                    break;
+                }
+                loaded.push_back((*row)["hostname"].to<std::string>());
+                if ((int64_t)loaded.size() >= count2cpy) {
+                    break;
+                }
+            }
+            std::swap(prev, row);
+            db_rc = t_dsk.search_by_index(DB_SEEK_LESS, *prev, 3, *row);
+        }
+        if (DB_OK != db_rc && !storage::data::Environment::is_error(DB_ENOTFOUND)) {
+            GET_ECODE(rc, db_rc, "while copying from on-disk to in-mem caches ");
+        }
+    }
+
+    if (DB_NOERROR == rc) {
+        db_rc = txn.commit();
+        GET_ECODE(rc, db_rc, "Commit warm-up transaction ");
+    }
+    if (DB_NOERROR == rc) {
+        // Hottest last, so recency-based policies keep it longest
+        std::lock_guard<std::mutex> policy_lock(policy_mutex);
+        std::vector<std::string> victims;
+        for (std::vector<std::string>::reverse_iterator it = loaded.rbegin(); it != loaded.rend(); ++it) {
+            mem_policy.on_insert(*it, victims);
+        }
+        cache_sizes[IN_MEM] = (int64_t)loaded.size();
+        warmup_rows = (int64_t)loaded.size();
+    }
+    else if (txn.isActive()) {
+        (void)txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+    }
+
+    warmup_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    EXAMPLE_LOG_INFO("Warm-up loaded " << warmup_rows << " of " << cache_sizes[ON_DISK]
+        << " on-disk rows in " << warmup_ms << " ms");
+    return rc;
+}
+
+int
+ManageHybridDatabase::sdb_save_disk_row_count()
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc = DB_OK;
+    std::lock_guard<std::mutex> lock(db_mutex);
+
+    // Pending writes, e.g. promotions drained by stop_promoter(), go first,
+    // so the rollback below can't undo them
+    storage::ittiadb::Transaction txn(db);
+    storage::ittiadb::Table saved_counts(db, "cache_row_counts");
+    rc = group_commit.commit_locked();
+    if (DB_NOERROR == rc) {
+        db_rc = txn.begin();
+        GET_ECODE(rc, db_rc, "Begin saving hosts_dsk row count ");
+    }
+    if (DB_NOERROR == rc) {
+        db_rc = saved_counts.open("cache_row_counts_pkey");
+        GET_ECODE(rc, db_rc, "Open cache_row_counts table ");
+    }
+    if (DB_NOERROR == rc) {
+        storage::data::SingleRow row(saved_counts.columns());
+        storage::data::SingleRow found(saved_counts.columns());
+        row["tablename"].set("hosts_dsk");
+        row["rowcount"].set((int64_t)cache_sizes[ON_DISK]);
+        db_rc = (DB_OK == saved_counts.search_by_index(DB_SEEK_FIRST_EQUAL, row, 1, found))
+            ? saved_counts.update_by_index(row, 1, row)
+            : saved_counts.insert(row);
+        GET_ECODE(rc, db_rc, "Save hosts_dsk row count ");
+        (void)saved_counts.close();
+    }
+    if (DB_NOERROR == rc) {
+        db_rc = txn.commit();
+        GET_ECODE(rc, db_rc, "Commit hosts_dsk row count ");
+    }
+    else if (txn.isActive()) {
+        (void)txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+    }
+    return rc;
+}
+
+int
+ManageHybridDatabase::sdb_merge_mem_cache_to_disk()
+{
+    int rc = DB_NOERROR;
+    int upd_cnt = 0;
+    int ins_cnt = 0;
+    std::lock_guard<std::mutex> lock(db_mutex);
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    take_dirty_rows_();
+    const size_t dirty_cnt = flushing_rows.size();
+
+    while (DB_NOERROR == rc && !flushing_rows.empty()) {
+        rc = sdb_write_back_batch(flushing_rows, upd_cnt, ins_cnt);
+    }
+
+    const int64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    EXAMPLE_LOG_INFO("Mem->Disk merge result (error_code, inmem_size, dirty, inserted, updated, ms): ("
+        << rc << "," << cache_sizes[IN_MEM] << "," << dirty_cnt << "," << ins_cnt << ","
+        << upd_cnt << "," << elapsed_ms << ")");
+    return rc;
+}
+
+void
+ManageHybridDatabase::take_dirty_rows_()
+{
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    if (flushing_rows.empty()) {
+        flushing_rows.swap(dirty_rows);
+        return;
+    }
+    // Left over from a failed batch: newer values replace them
+    for (dirty_rows_t::const_iterator it = dirty_rows.begin(); it != dirty_rows.end(); ++it) {
+        flushing_rows[it->first] = it->second;
+    }
+    dirty_rows.clear();
+}
+
+int
+ManageHybridDatabase::sdb_write_back_batch(dirty_rows_t& rows, int& upd_cnt, int& ins_cnt)
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc = DB_OK;
+    if (rows.empty()) {
+        return rc;
+    }
+
+    // Changes made on the resolve path so far go first, so that the batch
+    // below is a transaction of its own and a rollback can't undo them
+    storage::ittiadb::Transaction txn(db);
+    rc = group_commit.commit_locked();
+
+    storage::ittiadb::Table t_dsk(db, "hosts_dsk");
+    if (DB_NOERROR == rc) {
+        db_rc = t_dsk.open("hosts_pkey");
+        GET_ECODE(rc, db_rc, "Opening hosts_dsk table with hosts_pkey: ");
+    }
+    if (DB_NOERROR == rc) {
+        db_rc = txn.begin();
+        GET_ECODE(rc, db_rc, "Begin merge transaction ");
+    }
+    if (DB_NOERROR != rc) {
+        return rc;
+    }
+
+    storage::data::SingleRow key(t_dsk.columns());
+    storage::data::SingleRow found(t_dsk.columns());
+    storage::data::SingleRow row(t_dsk.columns());
+    int batch_upd = 0;
+    int batch_ins = 0;
+
+    // Keys ascend, so consecutive searches land on the same or the next
+    // B-tree page instead of a random one
+    const int64_t now = now_ms();
+    dirty_rows_t::iterator itr = rows.begin();
+    for (int n = 0; DB_NOERROR == rc && n < MERGE_BATCH_ROWS && itr != rows.end(); ++n, ++itr) {
+        key["hostname"].set(itr->first);
+        row["hostname"].set(itr->first);
+        row["hostip"].set(itr->second.hostip);
+        row["requestcount"].set(itr->second.requestcount);
+        row["age"].set(itr->second.age);
+        row["expires"].set(itr->second.expires);
+
+        db_rc = t_dsk.search_by_index(DB_SEEK_FIRST_EQUAL, key, 1, found);
+        GET_ECODE(rc, db_rc);
+        if (DB_NOERROR == rc) {
+            int64_t found_expires = 0;
+            found["expires"].get(found_expires);
+            // A newer DNS answer replaced the record since it was promoted
+            if (found_expires <= itr->second.expires) {
+                db_rc = t_dsk.update_by_index(key, 1, row);
+                GET_ECODE(rc, db_rc, "Updating from in-mem to on-disk ");
+                ++batch_upd;
+            }
+        }
+        else if (DB_ENOTFOUND == rc) {
+            // Shaped or swept out of the on-disk cache since it was
+            // promoted; only a record that is still valid comes back
+            rc = DB_NOERROR;
+            if (itr->second.expires > now) {
+                db_rc = t_dsk.insert(row);
+                GET_ECODE(rc, db_rc, "Inserting from in-mem to on-disk ");
+                ++batch_ins;
+            }
+        }
+    }
+
+    if (DB_NOERROR == rc) {
+        db_rc = txn.commit();
+        GET_ECODE(rc, db_rc, "Commit merge batch ");
+    }
+    if (DB_NOERROR == rc) {
+        rows.erase(rows.begin(), itr);
+        upd_cnt += batch_upd;
+        ins_cnt += batch_ins;
+        cache_sizes[ON_DISK] += batch_ins;
+    }
+    else {
+        // The whole batch is left in rows to be written again
+        (void)txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+    }
+    return rc;
+}
+
+void
+ManageHybridDatabase::start_flusher(int32_t interval_ms)
+{
+    if (!flusher) {
+        flush_interval_ms = interval_ms;
+        flusher_stop.reset();
+        flusher.reset(new example_thread(flusher_proc, this));
+    }
+}
+
+void
+ManageHybridDatabase::stop_flusher()
+{
+    if (flusher) {
+        flusher_stop.set();
+        flusher->join();
+        flusher.reset();
+    }
+}
+
+void
+ManageHybridDatabase::flusher_proc(void * arg)
+{
+    ManageHybridDatabase * mhd = static_cast<ManageHybridDatabase *>(arg);
+    while (!mhd->flusher_stop.wait_for_milliseconds(mhd->flush_interval_ms)) {
+        {
+            std::lock_guard<std::mutex> lock(mhd->db_mutex);
+            mhd->take_dirty_rows_();
+        }
+        int rc = DB_NOERROR;
+        bool more = true;
+        while (DB_NOERROR == rc && more && !mhd->flusher_stop.is_set()) {
+            // Released between batches, so a resolver waits for one batch
+            // at most
+            std::lock_guard<std::mutex> lock(mhd->db_mutex);
+            int upd_cnt = 0;
+            int ins_cnt = 0;
+            rc = mhd->sdb_write_back_batch(mhd->flushing_rows, upd_cnt, ins_cnt);
+            mhd->flushed_rows += upd_cnt + ins_cnt;
+            more = !mhd->flushing_rows.empty();
+        }
+        if (DB_NOERROR != rc) {
+            EXAMPLE_LOG_WARN("Background flush stopped with error " << rc
+                << "; the rest is written on the next flush");
+        }
+    }
+}
+
+int
+ManageHybridDatabase::sdb_put_into_cache(cache_type_t ctype, storage::data::Row& data, int64_t * ticket)
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc=DB_OK;
+    const char * table_name = (ctype == IN_MEM) ? "hosts_mem" : "hosts_dsk";
+    std::string hostname;
+    // Rows deleted on the way, restored with the insert if its commit fails
+    std::vector<std::string> evicted;
+    std::vector<std::string> not_evicted;
+    int64_t deleted = 0;
+    if (ctype == IN_MEM) {
+        // Make room for the new record first
+        std::vector<std::string> victims;
+        hostname = data["hostname"].to<std::string>();
+        {
+            std::lock_guard<std::mutex> lock(policy_mutex);
+            mem_policy.on_insert(hostname, victims);
+        }
+        rc = sdb_evict_mem(victims, &evicted, &not_evicted);
+        deleted = (int64_t)evicted.size();
+    }
+    else if (cache_sizes[ctype] > cache_size_limits[ctype]) {
+        (void)sdb_shape_cache(ctype, &deleted);
+    }
+    storage::ittiadb::Table table(db,table_name);
+    if (DB_NOERROR == rc) {
+        db_rc = table.open("hosts_pkey");
+        GET_ECODE(rc, db_rc, "sdb_put_into_cache: Open table ");
+    }
+    if (DB_NOERROR == rc && ctype == ON_DISK)
+    {
+        // A new DNS answer replaces the expired record of the same name
+        // that the sweeper hasn't reached yet
+        if (DB_OK == table.delete_by_index(data, 1)) {
+            cache_sizes[ctype]--;
+            ++deleted;
+        }
+    }
+    if (DB_NOERROR == rc)
+    {
+        db_rc = table.insert(data);
+        GET_ECODE(rc, db_rc, "sdb_put_into_cache: Couldn't put data into cache ");
+    }
+    if (DB_NOERROR == rc)
+    {
+        // Committed together with the writes of other callers, so lookups
+        // on other connections see the record within
+        // GROUP_COMMIT_MAX_DELAY_MS
+        cache_sizes[ctype]++;
+        const int64_t write_ticket = group_commit.add_write_locked(
+            [this, ctype, hostname, evicted, deleted]() { undo_put_(ctype, hostname, evicted, deleted); });
+        if (ticket != NULL) {
+            *ticket = write_ticket;
+        }
+    }
+    if (DB_NOERROR != rc && ctype == IN_MEM) {
+        // The record isn't cached, so the rows that are still there get
+        // their place in the policy back
+        std::vector<std::string> victims;
+        {
+            std::lock_guard<std::mutex> lock(policy_mutex);
+            mem_policy.on_remove(hostname);
+            for (size_t i = 0; i < not_evicted.size(); ++i) {
+                mem_policy.on_insert(not_evicted[i], victims);
+            }
+        }
+        (void)sdb_evict_mem(victims);
+        // The evictions already made are committed with the next batch
+        if (!evicted.empty()) {
+            (void)group_commit.add_write_locked(
+                [this, evicted, deleted]() { undo_deletes_(IN_MEM, evicted, deleted); });
+        }
+    }
+    return rc;
+}
+
+int
+ManageHybridDatabase::sdb_search_cache(example_connection_pool::lease& conn, cache_type_t ctype,
+                                       const std::string& hostname, storage::data::Row& result)
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc = DB_OK;
+    // Opened once per connection; every later lookup goes straight to the
+    // search. Opened shared, so lookups on other connections can use the
+    // table at the same time.
+    storage::ittiadb::Table * table = conn.table(ctype == IN_MEM ? "hosts_mem" : "hosts_dsk", "hosts_pkey");
+    if (NULL == table) {
+        return storage::data::Environment::error().code;
+    }
+    storage::data::SingleRow key(table->columns());
+    key["hostname"].set(hostname.c_str());
+    db_rc = table->search_by_index(DB_SEEK_FIRST_EQUAL, key, 1,result);
+    GET_ECODE(rc, db_rc);
+    if (DB_NOERROR == rc && is_expired(result, now_ms()))
+    {
+        // Expired: delete it now, and let the caller ask the DNS server
+        // again. The sweeper may have deleted it meanwhile.
+        if (DB_OK == table->delete_by_index(key, 1)
+            && DB_OK == storage::ittiadb::Transaction(conn.connection()).commit(storage::ittiadb::Transaction::LazyCompletion))
+        {
+            cache_sizes[ctype]--;
+            if (ctype == IN_MEM) {
+                std::lock_guard<std::mutex> lock(policy_mutex);
+                mem_policy.on_remove(hostname);
+            }
+        }
+        ++expired_on_read;
+        rc = DB_ENOTFOUND;
+    }
+    if (DB_NOERROR == rc && ctype == IN_MEM)
+    {
+        // Bump age and request count of the row just found. The count is
+        // incremented by the database in one statement, so hits on other
+        // connections can't overwrite each other's increments. The age
+        // comes from a block reserved in advance, so no sequence query is
+        // needed.
+        int64_t next_seq_value;
+        storage::ittiadb::Query * bump = conn.query(
+            "UPDATE hosts_mem SET requestcount = requestcount + 1, age = ? WHERE hostname = ?");
+        if (NULL == bump) {
+            rc = storage::data::Environment::error().code;
+        }
+        if (DB_NOERROR == rc) {
+            rc = next_age_(next_seq_value);
+        }
+        if (DB_NOERROR == rc) {
+            storage::data::SingleRow params(bump->parameters());
+            params[0].set(next_seq_value);
+            params[1].set(hostname.c_str());
+            const int64_t rows = bump->execute_with(params);
+            if (rows < 0) {
+                rc = storage::data::Environment::error().code;
+                EXAMPLE_LOG_ERROR("Updating result row :: " << storage::data::Environment::error());
+            }
+            else if (rows == 0) {
+                // Deleted by another connection since the search
+                rc = DB_ENOTFOUND;
+            }
+        }
+        if (DB_NOERROR == rc) {
+            // Read back the values the update left; the row stays locked
+            // until the commit, so the dirty entry is recorded in the same
+            // order as the updates.
+            db_rc = table->search_by_index(DB_SEEK_FIRST_EQUAL, key, 1, result);
+            GET_ECODE(rc, db_rc, "Reading updated row ");
+        }
+        if (DB_NOERROR == rc) {
+            mark_dirty_(hostname, result);
+            // A memory table: the commit doesn't wait for the disk
+            db_rc = storage::ittiadb::Transaction(conn.connection()).commit(storage::ittiadb::Transaction::LazyCompletion);
+            GET_ECODE(rc, db_rc, "Commit result row ");
+        }
+    }
+    return rc;
+}
+
+int
+ManageHybridDatabase::next_age_(int64_t& age)
+{
+    std::lock_guard<std::mutex> lock(age_mutex);
+    return age_seq.next_value(age);
+}
+
+int
+ManageHybridDatabase::open_mem_by_name_()
+{
+    int rc = DB_NOERROR;
+    if (!mem_by_name_open) {
+        // Opened once; every later hit goes straight to the search
+        db_result_t db_rc = mem_by_name.open("hosts_pkey");
+        GET_ECODE(rc, db_rc, "open_mem_by_name_: Opening Table ");
+        mem_by_name_open = DB_NOERROR == rc;
+    }
+    return rc;
+}
+
+int
+ManageHybridDatabase::sdb_find_mem(const std::string& hostname, bool& found)
+{
+    int rc = open_mem_by_name_();
+    found = false;
+    if (DB_NOERROR == rc) {
+        storage::data::SingleRow key(mem_by_name.columns());
+        storage::data::SingleRow row(mem_by_name.columns());
+        key["hostname"].set(hostname);
+        db_result_t db_rc = mem_by_name.search_by_index(DB_SEEK_FIRST_EQUAL, key, 1, row);
+        GET_ECODE(rc, db_rc);
+        found = DB_NOERROR == rc;
+        if (DB_ENOTFOUND == rc) {
+            rc = DB_NOERROR;
+        }
+    }
+    return rc;
+}
+
+void
+ManageHybridDatabase::queue_promotion_(const std::string& hostname, storage::data::Row& row)
+{
+    promotion_t promotion;
+    promotion.hostname = hostname;
+    row["hostip"].get(promotion.values.hostip);
+    row["requestcount"].get(promotion.values.requestcount);
+    row["age"].get(promotion.values.age);
+    row["expires"].get(promotion.values.expires);
+    if (promotions.push(promotion)) {
+        ++promotions_queued;
+        promoter_wake.set();
+    }
+    else {
+        // The worker is behind; the next hit of this name tries again
+        ++promotions_dropped;
+    }
+}
+
+int
+ManageHybridDatabase::sdb_promote(const promotion_t& promotion)
+{
+    int rc = DB_NOERROR;
+    bool found = false;
+    storage::ittiadb::Table t_dsk(db, "hosts_dsk");
+    storage::data::SingleRow row(t_dsk.columns());
+
+    // Another hit of the same name may have been queued before this one
+    // was copied
+    const int64_t now = now_ms();
+    rc = sdb_find_mem(promotion.hostname, found);
+    if (DB_NOERROR == rc && !found && promotion.values.expires > now) {
+        row["hostname"].set(promotion.hostname);
+        row["hostip"].set(promotion.values.hostip);
+        row["requestcount"].set(promotion.values.requestcount);
+        row["age"].set(promotion.values.age);
+        row["expires"].set(promotion.values.expires);
+        rc = sdb_put_into_cache(IN_MEM, row);
+    }
+    if (DB_NOERROR != rc || prefetch_neighbors <= 0) {
+        return rc;
+    }
+
+    db_result_t db_rc = t_dsk.open("hosts_pkey");
+    GET_ECODE(rc, db_rc, "sdb_promote: Opening Table ");
+    storage::data::SingleRow key(t_dsk.columns());
+    key["hostname"].set(promotion.hostname);
+    for (int32_t i = 0; DB_NOERROR == rc && i < prefetch_neighbors; ++i) {
+        db_rc = t_dsk.search_by_index(DB_SEEK_GREATER, key, 1, row);
+        if (DB_OK != db_rc) {
+            // No more records after this one is not an error
+            if (!storage::data::Environment::is_error(DB_ENOTFOUND)) {
+                GET_ECODE(rc, db_rc, "sdb_promote: Reading next record ");
+            }
+            break;
+        }
+        const std::string hostname = row["hostname"].to<std::string>();
+        key["hostname"].set(hostname);
+        rc = sdb_find_mem(hostname, found);
+        bool admit = false;
+        if (DB_NOERROR == rc && !found && !is_expired(row, now)) {
+            std::lock_guard<std::mutex> lock(policy_mutex);
+            admit = mem_policy.admit(hostname);
+        }
+        if (DB_NOERROR == rc && !found && admit) {
+            rc = sdb_put_into_cache(IN_MEM, row);
+            if (DB_NOERROR == rc) {
+                ++prefetched;
+            }
+        }
+    }
+    return rc;
+}
+
+void
+ManageHybridDatabase::start_promoter(int32_t prefetch_neighbors)
+{
+    if (!promoter) {
+        this->prefetch_neighbors = prefetch_neighbors;
+        promoter_stop.reset();
+        promoter.reset(new example_thread(promoter_proc, this));
+    }
+}
+
+void
+ManageHybridDatabase::stop_promoter()
+{
+    if (promoter) {
+        promoter_stop.set();
+        promoter_wake.set();
+        promoter->join();
+        promoter.reset();
+    }
+}
+
+void
+ManageHybridDatabase::promoter_proc(void * arg)
+{
+    ManageHybridDatabase * mhd = static_cast<ManageHybridDatabase *>(arg);
+    promotion_t promotion;
+    for (;;) {
+        // Checked before the queue, so hits queued before stop_promoter()
+        // are still copied
+        const bool stopping = mhd->promoter_stop.is_set();
+        if (!mhd->promotions.pop(promotion)) {
+            if (stopping) {
+                break;
+            }
+            (void)mhd->promoter_wake.wait_for_milliseconds(100);
+            continue;
+        }
+        // Released every PROMOTION_BATCH copies, so lookups don't wait
+        // for the whole queue
+        std::lock_guard<std::mutex> lock(mhd->db_mutex);
+        int n = 0;
+        do {
+            const int rc = mhd->sdb_promote(promotion);
+            if (DB_NOERROR != rc) {
+                EXAMPLE_LOG_WARN("Couldn't copy " << promotion.hostname << " to the in-mem cache, error " << rc);
+            }
+        } while (++n < PROMOTION_BATCH && mhd->promotions.pop(promotion));
+    }
+}
+
+int
+ManageHybridDatabase::sdb_sweep_expired(cache_type_t ctype, int& deleted)
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc = DB_OK;
+    const char * table_name = ctype == IN_MEM ? "hosts_mem" : "hosts_dsk";
+    const int64_t now = now_ms();
+    deleted = 0;
+
+    storage::ittiadb::Table by_expiry(db, table_name);
+    storage::ittiadb::Table by_name(db, table_name);
+    db_rc = by_expiry.open("hosts_expires_idx");
+    GET_ECODE(rc, db_rc, "sdb_sweep_expired: Opening Table ");
+    if (DB_NOERROR == rc) {
+        db_rc = by_name.open("hosts_pkey");
+        GET_ECODE(rc, db_rc, "sdb_sweep_expired: Opening Table ");
+    }
+    storage::data::SingleRow first(by_expiry.columns());
+    storage::data::SingleRow row(by_expiry.columns());
+    first["expires"].set(std::numeric_limits<int64_t>::min());
+    // Records already deleted by a lookup count towards the batch too, so
+    // the sweep ends even if the search keeps returning one of them
+    int skipped = 0;
+    // In-mem names the policy forgot, given back if the commit fails
+    std::vector<std::string> swept_names;
+    while (DB_NOERROR == rc && deleted + skipped < SWEEP_BATCH) {
+        // The record that expires first
+        db_rc = by_expiry.search_by_index(DB_SEEK_GREATER_OR_EQUAL, first, 1, row);
+        if (DB_OK != db_rc) {
+            if (!storage::data::Environment::is_error(DB_ENOTFOUND)) {
+                GET_ECODE(rc, db_rc, "sdb_sweep_expired: Reading first record ");
+            }
+            break;
+        }
+        if (!is_expired(row, now)) {
+            break;
+        }
+        // Deleted by name, so each record is counted and the policy
+        // forgets it. A lookup that found the record expired may have
+        // deleted it since the search; it is gone either way.
+        db_rc = by_name.delete_by_index(row, 1);
+        if (DB_OK != db_rc && storage::data::Environment::is_error(DB_ENOTFOUND)) {
+            ++skipped;
+            continue;
+        }
+        GET_ECODE(rc, db_rc, "Occured when deleting expired cache records ");
+        if (DB_NOERROR == rc) {
+            ++deleted;
+            cache_sizes[ctype]--;
+            if (ctype == IN_MEM) {
+                swept_names.push_back(row["hostname"].to<std::string>());
+                std::lock_guard<std::mutex> lock(policy_mutex);
+                mem_policy.on_remove(swept_names.back());
+            }
+        }
+    }
+    if (deleted > 0) {
+        const int swept_count = deleted;
+        (void)group_commit.add_write_locked(
+            [this, ctype, swept_names, swept_count]() { undo_deletes_(ctype, swept_names, swept_count); });
+    }
+    return rc;
+}
+
+void
+ManageHybridDatabase::start_sweeper(int32_t interval_ms)
+{
+    if (!sweeper) {
+        sweep_interval_ms = interval_ms;
+        sweeper_stop.reset();
+        sweeper.reset(new example_thread(sweeper_proc, this));
+    }
+}
+
+void
+ManageHybridDatabase::stop_sweeper()
+{
+    if (sweeper) {
+        sweeper_stop.set();
+        sweeper->join();
+        sweeper.reset();
+    }
+}
+
+void
+ManageHybridDatabase::sweeper_proc(void * arg)
+{
+    ManageHybridDatabase * mhd = static_cast<ManageHybridDatabase *>(arg);
+    while (!mhd->sweeper_stop.wait_for_milliseconds(mhd->sweep_interval_ms)) {
+        for (int c = 0; c < CT_GUARD; ++c) {
+            int rc = DB_NOERROR;
+            int deleted = SWEEP_BATCH;
+            while (DB_NOERROR == rc && deleted == SWEEP_BATCH && !mhd->sweeper_stop.is_set()) {
+                // Released between batches, so a lookup or writer waits
+                // for one batch at most
+                std::lock_guard<std::mutex> lock(mhd->db_mutex);
+                rc = mhd->sdb_sweep_expired((cache_type_t)c, deleted);
+                mhd->swept += deleted;
+            }
+            if (DB_NOERROR != rc) {
+                EXAMPLE_LOG_WARN("Sweep of expired " << (c == IN_MEM ? "IN-MEM" : "ON-DISK")
+                    << " records stopped with error " << rc);
+            }
+        }
+    }
+}
+
+int
+ManageHybridDatabase::sdb_shape_cache(cache_type_t ctype, int64_t * deleted)
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc = DB_OK;
+    const char * table_name = ctype == IN_MEM ? "hosts_mem" : "hosts_dsk";
+    int count2del = cache_del_chunks[ctype];
+    EXAMPLE_LOG_DEBUG("Delete " << count2del << " rows from " 
+        << (ctype == IN_MEM ? "IN-MEM" : "ON-DISK") << " cache");
+    storage::ittiadb::Table table(db, table_name);
+    db_rc = table.open("hosts_age_idx");
     GET_ECODE(rc, db_rc, "sdb_shape_cache: Opening Table ");
     storage::data::SingleRow first_row(table.columns());
     for (; (DB_NOERROR == rc) && (count2del); --count2del)
@@ -516,9 +1997,235 @@ ManageHybridDatabase::sdb_shape_cache(cache_type_t ctype)
         {
             db_rc = table.delete_by_index(first_row,1);
             GET_ECODE(rc, db_rc, "Occured when deleting cache records ");
+        }
+        if (DB_NOERROR == rc)
+        {
             cache_sizes[ctype]--;
+            if (deleted != NULL) {
+                ++*deleted;
+            }
+        }
+    }
+
+    return rc;
+}
+
+int
+ManageHybridDatabase::sdb_evict_mem(const std::vector<std::string>& hostnames,
+                                    std::vector<std::string> * evicted,
+                                    std::vector<std::string> * not_evicted)
+{
+    int rc = DB_NOERROR;
+    db_result_t db_rc = DB_OK;
+    if (hostnames.empty()) {
+        return rc;
+    }
+    storage::ittiadb::Table table(db, "hosts_mem");
+    db_rc = table.open("hosts_pkey");
+    GET_ECODE(rc, db_rc, "sdb_evict_mem: Opening Table ");
+    storage::data::SingleRow key(table.columns());
+    size_t i = 0;
+    for (; (DB_NOERROR == rc) && (i < hostnames.size()); ++i)
+    {
+        key["hostname"].set(hostnames[i]);
+        db_rc = table.delete_by_index(key, 1);
+        if (DB_OK != db_rc && storage::data::Environment::is_error(DB_ENOTFOUND)) {
+            // Found expired and deleted by a lookup, which counted it
+            continue;
+        }
+        GET_ECODE(rc, db_rc, "Occured when evicting in-mem cache records ");
+        if (DB_NOERROR == rc)
+        {
+            cache_sizes[IN_MEM]--;
+            evictions++;
+            if (evicted != NULL) {
+                evicted->push_back(hostnames[i]);
+            }
         }
+        else {
+            break;
+        }
+    }
+    if (DB_NOERROR != rc && not_evicted != NULL) {
+        not_evicted->insert(not_evicted->end(), hostnames.begin() + i, hostnames.end());
     }
+    return rc;
+}
 
+void
+ManageHybridDatabase::undo_put_(cache_type_t ctype, const std::string& hostname,
+                                const std::vector<std::string>& evicted, int64_t deleted)
+{
+    // The rollback took the inserted row out and put the deleted ones back
+    cache_sizes[ctype] += deleted - 1;
+    if (ctype == IN_MEM) {
+        std::vector<std::string> victims;
+        {
+            std::lock_guard<std::mutex> lock(policy_mutex);
+            mem_policy.on_remove(hostname);
+            for (size_t i = 0; i < evicted.size(); ++i) {
+                mem_policy.on_insert(evicted[i], victims);
+            }
+        }
+        evictions -= (int64_t)evicted.size();
+        // The evicted rows fitted before the insert, so the policy rarely
+        // hands back any; delete them so the table matches the policy.
+        (void)sdb_evict_mem(victims);
+    }
+}
+
+void
+ManageHybridDatabase::undo_deletes_(cache_type_t ctype, const std::vector<std::string>& names, int64_t deleted)
+{
+    // The rollback put the records back; expired ones are swept again later
+    cache_sizes[ctype] += deleted;
+    if (ctype == IN_MEM) {
+        std::vector<std::string> victims;
+        {
+            std::lock_guard<std::mutex> lock(policy_mutex);
+            for (size_t i = 0; i < names.size(); ++i) {
+                mem_policy.on_insert(names[i], victims);
+            }
+        }
+        (void)sdb_evict_mem(victims);
+    }
+}
+
+void
+ManageHybridDatabase::mark_dirty_(const std::string& hostname, storage::data::Row& row)
+{
+    std::lock_guard<std::mutex> lock(dirty_mutex);
+    host_values_t& values = dirty_rows[hostname];
+    row["hostip"].get(values.hostip);
+    row["requestcount"].get(values.requestcount);
+    row["age"].get(values.age);
+    row["expires"].get(values.expires);
+}
+
+void
+ManageHybridDatabase::print_cache_stats() const
+{
+    std::lock_guard<std::mutex> lock(db_mutex);
+    const int64_t requests = tier_stats[IN_MEM].lookups;
+    const int64_t served = tier_stats[IN_MEM].hits + tier_stats[ON_DISK].hits;
+    std::cout << "Cache policy " << mem_policy.name() << ":" << std::endl;
+    std::cout << "  warm-up: " << warmup_rows << " rows in " << warmup_ms << " ms" << std::endl;
+    for (int i = 0; i < CT_GUARD; ++i) {
+        const tier_stats_t& stats = tier_stats[i];
+        std::cout << "  " << (i == IN_MEM ? "IN-MEM " : "ON-DISK") << " hits: " << stats.hits
+            << " of " << stats.lookups << " lookups ("
+            << (stats.lookups ? stats.hits * 100 / stats.lookups : 0) << "%)" << std::endl;
+    }
+    std::cout << "  served from cache: " << served << " of " << requests << " requests ("
+        << (requests ? served * 100 / requests : 0) << "%)" << std::endl;
+    std::cout << "  in-mem admissions: " << admissions << ", rejected: " << rejections
+        << ", evictions: " << evictions << std::endl;
+    std::cout << "  promotions queued: " << promotions_queued << ", dropped: " << promotions_dropped
+        << ", neighbors prefetched: " << prefetched << std::endl;
+    std::cout << "  rows flushed in background: " << flushed_rows << std::endl;
+    std::cout << "  expired records: " << expired_on_read << " found on read, "
+        << swept << " swept" << std::endl;
+    int64_t commits = 0;
+    int64_t writes = 0;
+    group_commit.statistics(commits, writes);
+    std::cout << "  group commits: " << commits << " for " << writes << " writes" << std::endl;
+}
+
+static void
+client_thread_proc(void * arg)
+{
+    client_thread_t * client = static_cast<client_thread_t *>(arg);
+    char hostname[MAX_HOSTNAME_LEN + 1] = "";
+    std::string ip;
+
+    client->rc = DB_NOERROR;
+    for (int i = 0; i < CONCURRENT_CLIENT_REQUESTS && DB_NOERROR == client->rc; ++i) {
+        DataGenerator::generate_request_hostname(client->seed, hostname);
+        const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        int rc = client->mhd->resolve_ip_by_hostname(hostname, ip);
+        client->latencies_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started).count());
+        // "Not found" is a valid answer for the names that don't exist
+        client->rc = DB_ENOTFOUND == rc ? DB_NOERROR : rc;
+    }
+}
+
+static int
+run_concurrent_clients(ManageHybridDatabase& mhd, int thread_count, double& requests_per_second)
+{
+    int rc = DB_NOERROR;
+    std::vector<client_thread_t> clients(thread_count);
+    std::vector<example_thread *> threads;
+    const resolver_stats_t stats_before = mhd.resolver_stats();
+
+    DataGenerator::upstream_latency_ms = UPSTREAM_LATENCY_MS;
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    for (int t = 0; t < thread_count; ++t) {
+        clients[t].mhd = &mhd;
+        clients[t].seed = 1 + t;
+        clients[t].rc = DB_NOERROR;
+        clients[t].latencies_us.reserve(CONCURRENT_CLIENT_REQUESTS);
+        threads.push_back(new example_thread(client_thread_proc, &clients[t]));
+    }
+    std::vector<int64_t> latencies_us;
+    for (int t = 0; t < thread_count; ++t) {
+        threads[t]->join();
+        delete threads[t];
+        latencies_us.insert(latencies_us.end(), clients[t].latencies_us.begin(), clients[t].latencies_us.end());
+        if (DB_NOERROR == rc) {
+            rc = clients[t].rc;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    DataGenerator::upstream_latency_ms = 0;
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    const size_t requests = latencies_us.size();
+    const int64_t p50 = requests ? latencies_us[requests / 2] : 0;
+    const int64_t p99 = requests ? latencies_us[std::min(requests - 1, requests * 99 / 100)] : 0;
+
+    // Without coalescing and the negative cache, each of these would
+    // have been a DNS request
+    resolver_stats_t stats = mhd.resolver_stats();
+    stats.upstream_calls -= stats_before.upstream_calls;
+    stats.coalesced -= stats_before.coalesced;
+    stats.negative_hits -= stats_before.negative_hits;
+    const int64_t misses = stats.upstream_calls + stats.coalesced + stats.negative_hits;
+
+    requests_per_second = seconds > 0 ? requests / seconds : 0;
+
+    example_log_flush();
+    std::cout << thread_count << " client threads, " << requests << " requests in " << seconds << " s ("
+        << (int64_t)requests_per_second << " requests/s)" << std::endl;
+    std::cout << "  latency p50: " << p50 << " us, p99: " << p99 << " us" << std::endl;
+    std::cout << "  cache misses: " << misses << ", DNS requests: " << stats.upstream_calls
+        << " (" << (misses ? (misses - stats.upstream_calls) * 100 / misses : 0) << "% saved: "
+        << stats.coalesced << " coalesced, " << stats.negative_hits << " negative cache hits)" << std::endl;
+    return rc;
+}
+
+static int
+run_scaling_benchmark(ManageHybridDatabase& mhd, int max_threads)
+{
+    int rc = DB_NOERROR;
+    std::vector<int> thread_counts;
+    std::vector<double> throughput;
+    for (int t = 1; t < max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    for (size_t i = 0; i < thread_counts.size() && DB_NOERROR == rc; ++i) {
+        double requests_per_second = 0;
+        rc = run_concurrent_clients(mhd, thread_counts[i], requests_per_second);
+        throughput.push_back(requests_per_second);
+    }
+
+    std::cout << "Scaling (threads, requests/s, speedup over 1 thread):" << std::endl;
+    for (size_t i = 0; i < throughput.size(); ++i) {
+        const double speedup = throughput[0] > 0 ? throughput[i] / throughput[0] : 0;
+        std::cout << "  " << thread_counts[i] << ", " << (int64_t)throughput[i] << ", "
+            << (int64_t)(speedup * 100) / 100.0 << "x" << std::endl;
+    }
     return rc;
 }
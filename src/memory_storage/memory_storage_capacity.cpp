@@ -35,9 +35,23 @@
 #include "storage/ittiadb/query.h"
 #include "storage/data/single_row.h"
 #include "storage/data/single_field.h"
+#include "storage/data/row_set.h"
+#include "db_cursor.h"
 #include "db_iostream.h"
+#include "db_sequence.h"
+#include "example_log.h"
+#include "example_storage_fill.h"
+#include "example_task_queue.h"
+#include "example_thread.h"
 
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 static const char* EXAMPLE_DATABASE = "full_memory_storage.ittiadb";
 
@@ -50,6 +64,32 @@ static const int32_t MAX_IP_LEN = 16;
 static const int32_t HOSTS_COUNT =1000;
 ///< Count of unique ports which example data provider can generate
 static const int32_t PORTS_COUNT =10;
+/// Ages and host ids reserved from age_seq per database call
+static const int32_t AGE_SEQ_BLOCK = 64;
+/// Page size and page count of the cache memory storage
+static const int64_t MEMORY_PAGE_SIZE = DB_DEF_PAGE_SIZE * 4;
+static const int64_t MEMORY_STORAGE_PAGES = 100;
+/// Rows read per lock while saving a snapshot
+static const size_t SNAPSHOT_BATCH = 256;
+
+/// Columns and primary key of 'hosts', shared by the memory storage
+/// schema and the snapshot image
+static const char* HOSTS_COLUMNS_SQL =
+    "hostid sint32 NOT NULL,"
+    "hostip ansistr(16) NOT NULL,"
+    "hostname ansistr(50) NULL,"
+    "iostat sint64 NULL,"
+    "conncount sint32 NOT NULL,"
+    "age sint64 NULL,"
+    "CONSTRAINT hosts_pkey PRIMARY KEY(hostid)";
+/// Columns and primary key of 'connstat' @sa HOSTS_COLUMNS_SQL
+static const char* CONNSTAT_COLUMNS_SQL =
+    "hostid sint32 NOT NULL,"
+    "dport sint32 NOT NULL,"
+    "sport uint32 NOT NULL,"
+    "iostat uint64 NULL,"
+    "age sint32 NULL,"
+    "CONSTRAINT cs_pkey PRIMARY KEY(hostid, dport, sport)";
 
 /// Input/output statistics for remote host connection
 // This is a structure which 'external' (to this module)
@@ -62,6 +102,58 @@ typedef struct
     int64_t  io_bytes;  ///< in + out bytes transfered
 } io_stat_row_t;
 
+/// Connection identity used to merge samples before they are written.
+struct io_stat_key_t
+{
+    std::string hostip; ///< IP of remote host
+    int  dport;         ///< remote connection port
+    int  sport;         ///< local connection port
+
+    bool operator==(const io_stat_key_t& other) const
+    {
+        return dport == other.dport && sport == other.sport && hostip == other.hostip;
+    }
+};
+
+/// Change to summary statistics of one host.
+struct host_stat_delta_t
+{
+    int32_t conncount;
+    int64_t iostat;
+
+    host_stat_delta_t() : conncount(0), iostat(0) {}
+};
+
+/// Summary statistics of one host, as read back from 'hosts' table.
+struct host_summary_t
+{
+    std::string hostip;
+    int64_t iostat;
+    int32_t conncount;
+};
+
+/// Deltas by hostid, applied in key order.
+typedef std::map<int32_t, host_stat_delta_t> host_stat_deltas_t;
+
+struct io_stat_key_hash
+{
+    size_t operator()(const io_stat_key_t& key) const
+    {
+        size_t h = std::hash<std::string>()(key.hostip);
+        h = h * 31 + std::hash<int>()(key.dport);
+        return h * 31 + std::hash<int>()(key.sport);
+    }
+};
+
+/// Storage taken by the empty schema and by each row of 'hosts' and
+/// 'connstat', including its index entries @sa measure_row_sizes
+struct row_sizes_t
+{
+    double fixed_bytes;
+    double host_row_bytes;
+    double conn_row_bytes;
+};
+
 /// @brief Manages Memory cache for Memory DB schema to use in 'full_memory_storage' examples.
 ///
 ///  This examples supposed to be by part of some software which collects network information
@@ -84,7 +176,14 @@ typedef struct
 ///
 /// - Create a memory storage that is smaller than the amount of data that will be inserted.
 /// - Insert into a memory table many times in separate transactions.
-/// - When memory storage becomes full, delete some old records and try inserting again.
+/// - Keep memory storage usage between a high and a low watermark, deleting
+///   old records in a background thread before the storage becomes full.
+///
+/// Storage usage is computed from row counts and the storage taken per row,
+/// which measure_row_sizes measures once, by filling scratch memory storages
+/// of the same page size, before collection starts. If a transaction still
+/// runs out of pages, the sizes are corrected so that the rows present at
+/// that moment fill the whole storage.
 class ManageMemoryCache
 {
 public:
@@ -93,29 +192,120 @@ public:
     /// @param connection
     ///  A database connection object. The connection must be opened before
     ///  any member functions can be used.
-    explicit ManageMemoryCache(storage::ittiadb::Connection& connection);
+    /// @param memory_storage_size
+    ///  Size of the memory storage, in bytes, as configured when the
+    ///  connection was opened.
+    ManageMemoryCache(storage::ittiadb::Connection& connection, int64_t memory_storage_size);
 
     /// Destructor, 
     ~ManageMemoryCache();
 
+    /// Use measured row sizes, so that the watermarks compare real usage.
+    /// The same sizes serve every cache with the same page size.
+    void set_row_sizes(const row_sizes_t& sizes);
+
     /// Increment connection in/out statistics by io_stat.io_bytes count
     int  sdb_inc_io_stat(const io_stat_row_t& io_stat);
+    /// Add io_stat to an in-process buffer instead of writing it at once.
+    /// Samples for the same connection are merged, and the buffer is
+    /// written in one transaction every FLUSH_SAMPLES samples or
+    /// FLUSH_INTERVAL_MS milliseconds, whichever comes first. While the
+    /// evictor thread runs, it writes samples that have waited
+    /// FLUSH_INTERVAL_MS even if no more samples arrive.
+    int  sdb_collect_io_stat(const io_stat_row_t& io_stat);
+    /// Write all buffered statistics in one transaction.
+    int  sdb_flush_io_stats();
+    /// Print hit rate of the hostip to hostid lookup cache.
+    void print_host_cache_stats() const;
+    /// Start a thread that evicts old records whenever storage
+    /// usage rises above HIGH_WATERMARK_PCT, and flushes buffered samples
+    /// on time when traffic is idle. Without it, eviction runs inline after
+    /// each commit.
+    void start_evictor();
+    /// Stop the evictor thread, if running.
+    void stop_evictor();
+    /// Print storage usage and eviction counts.
+    void print_memory_usage() const;
+    /// Append summary statistics of all hosts in 'hosts' table to 'hosts'.
+    int  sdb_read_hosts(std::vector<host_summary_t>& hosts);
+    /// Copy both tables to a compact file database at 'snapshot_uri'.
+    /// Rows are read under the lock SNAPSHOT_BATCH at a time; the slow disk
+    /// writes happen while it is released, into a temporary image that
+    /// replaces the old one.
+    int  sdb_save_snapshot(const std::string& snapshot_uri);
+    /// Load rows saved by sdb_save_snapshot into the empty memory tables.
+    /// Returns DB_ENOTFOUND if there is no snapshot.
+    int  sdb_load_snapshot(const std::string& snapshot_uri);
+    /// Start a thread that saves a snapshot every 'interval_ms' milliseconds.
+    void start_snapshots(const std::string& snapshot_uri, int32_t interval_ms);
+    /// Stop the snapshot thread, if running.
+    void stop_snapshots();
     /// Example data generator
-    void generate_iostat_row(io_stat_row_t& r, int solt);
+    static void generate_iostat_row(io_stat_row_t& r, int solt);
 
 private:
-    /// Remove 'count' of the most old/aged records from 'hosts' table.
+    /// Open long-lived table handles and prepare the per-sample statements,
+    /// if not already done.
+    int sdb_open_tables_();
+    /// Close table handles and statements, e.g. after a rollback; they are
+    /// reopened on next use.
+    void sdb_close_tables_();
+    /// Read the 'count' oldest rows of a table, ordered by age, into 'rows'.
+    /// 'max_age' is set to the age of the last row read.
+    int sdb_select_oldest_(const char * select_sql, int count,
+                           storage::data::RowSet<>& rows, int64_t& max_age);
+    /// Delete all rows with age up to 'max_age' in one statement.
+    int sdb_delete_up_to_age_(const char * delete_sql, int64_t max_age, int64_t& rows_deleted);
+    /// Apply one (possibly merged) sample inside the current transaction.
+    int sdb_apply_io_stat_(const io_stat_row_t& io_stat);
+    /// Write buffered statistics; db_mutex must be held. If the storage
+    /// runs out of pages, evict and try once more when 'retry_when_full'.
+    int sdb_flush_io_stats_(bool retry_when_full = true);
+    /// Roll back 'txn' and restore in-process state saved before it began.
+    void sdb_rollback_(storage::ittiadb::Transaction& txn, int rc,
+                       int save_hosts_rows_count, int save_connstat_rows_count);
+    /// Memory storage usage, in percent of memory_storage_size.
+    int storage_used_pct_() const;
+    /// Delete old records inside the current transaction until usage is at
+    /// most 'target_pct'.
+    int sdb_evict_to_(int target_pct);
+    /// Run sdb_evict_to_ in its own transaction.
+    int sdb_evict_(int target_pct);
+    /// Copy 'table_name' to 'image_table' in chunks, in the order of
+    /// 'index_name', locking db_mutex only while a chunk is read. Time spent
+    /// holding the lock is added to 'locked'.
+    int sdb_copy_to_image_(const char * table_name, const char * index_name, int key_fields,
+                           storage::ittiadb::Table& image_table, int64_t& rows,
+                           std::chrono::steady_clock::duration& locked);
+    /// Insert the rows of 'table_name' in 'image' into 'target', reading
+    /// them in chunks in the order of 'index_name'; db_mutex must be held.
+    /// With 'skip_orphans', rows whose host isn't in 'hosts' are skipped.
+    /// 'max_age' is raised to the newest age loaded.
+    int sdb_load_from_image_(storage::ittiadb::Connection& image, const char * table_name,
+                             const char * index_name, int key_fields, bool skip_orphans,
+                             storage::ittiadb::Table& target, int64_t& rows, int64_t& max_age);
+    /// Evictor thread procedure @sa start_evictor
+    static void evictor_proc(void * arg);
+    /// Snapshot thread procedure @sa start_snapshots
+    static void snapshot_proc(void * arg);
+    /// Remove 'count' of the most old/aged records from 'hosts' table
+    /// with a single age range delete.
     /// Recalc 'hosts_rows_count' & connstat_rows_count statistics.
     int sdb_remove_old_hosts(int count);
     /// Append record into 'hosts' table
     int sdb_add_host(const char *hostip, int64_t iostat, int32_t& hostid);
     /// Lookup 'hosts' table to find out 'hostid' by 'hostip'.    
     int sdb_find_host_by_ip(const char * hostip, int32_t& hostid);
+    /// Remember hostid of a host present in 'hosts' table.
+    void host_cache_put(const char * hostip, int32_t hostid);
+    /// Forget cached hosts after a rollback, as their rows may have been undone.
+    void host_cache_invalidate();
     /// Increment summary host statistics. - Just update 'hosts' record.    
     int sdb_inc_host_stat_(int32_t hostid, int64_t new_age, int32_t ccount_delta, int64_t iostat_delta);
 
-    /// Removes 'count' of the most aged 'connstat' records.
-    /// Corrects summary hosts statistics.
+    /// Removes 'count' of the most aged 'connstat' records with a single
+    /// age range delete. Corrects summary hosts statistics with one update
+    /// per affected host.
     int sdb_remove_old_conns(int count);
     ///Insert/Update 'connstat' table with 'stat' data.
     int sdb_inc_conn_stat(int32_t hostid, const io_stat_row_t &stat);
@@ -123,66 +313,190 @@ private:
 private:
     /// Reference to database connection
     storage::ittiadb::Connection& db;
+
+    /// Table handles are opened once and repositioned by each search,
+    /// instead of being opened for every sample. They are opened in shared
+    /// mode, as they stay open across transactions @sa sdb_open_tables_
+    bool tables_open;
+    storage::ittiadb::Table hosts_by_id;   ///< 'hosts' on hosts_pkey
+    storage::ittiadb::Table hosts_by_ip;   ///< 'hosts' on hosts_ip_idx
+    storage::ittiadb::Table conns_by_key;  ///< 'connstat' on cs_pkey
+    /// Statements run for every sample, prepared together with the tables
+    storage::ittiadb::Query insert_host;
+    storage::ittiadb::Query update_conn;
+    storage::ittiadb::Query insert_conn;
+
+    /// Ages and host ids, handed out locally from blocks of age_seq
+    SequenceBlockAllocator age_seq;
+
+    /// The connection is shared with the evictor thread, so all database
+    /// access and in-process state below is guarded by this mutex
+    mutable std::mutex db_mutex;
+
     ///Records count in 'hosts' table.
-    //We use it to estimate when
-    //our cache(in it's 'hosts' part) is getting too big.
-    //If hosts_rows_count >= HOSTS_DB_LIMIT, then we remove
-    //OLD_HOSTS_REMOVE_CHUNK from 'hosts' table.
+    //We use it to estimate how much of the
+    //memory storage our cache(in it's 'hosts' part) takes.
     int hosts_rows_count;
     ///Records count in 'connstat' table.
-    //We use it to estimate when
-    //our cache(in it's 'connstat' part) is getting too big:
-    //If connstat_rows_count >= CONNSTAT_DB_LIMIT, then we remove
-    //OLD_CONNS_REMOVE_CHUNK from 'connstat' table.
+    //We use it to estimate how much of the
+    //memory storage our cache(in it's 'connstat' part) takes.
     int connstat_rows_count;
 
-    /// Maximum records allowed to hold by "hosts" table @sa hosts_rows_count
-    const int32_t HOSTS_DB_LIMIT;
-    /// When HOSTS_DB_LIMIT reached drop this count of old hosts rows @sa hosts_rows_count
+    /// Size of the memory storage, in bytes
+    const int64_t MEMORY_STORAGE_SIZE;
+    /// Storage bytes taken by the empty schema @sa set_row_sizes
+    double fixed_bytes;
+    /// Storage bytes taken by one row, including its index entries
+    double host_row_bytes;
+    double conn_row_bytes;
+    /// Wake the evictor when usage reaches this percentage
+    const int HIGH_WATERMARK_PCT;
+    /// The evictor deletes old records until usage falls to this percentage
+    const int LOW_WATERMARK_PCT;
+    /// Evict inline before an insert if the evictor has fallen this far behind
+    const int HARD_LIMIT_PCT;
+    /// Drop this count of old hosts rows per eviction step @sa hosts_rows_count
     const int32_t OLD_HOSTS_REMOVE_CHUNK;
-    /// Maximum records we allow to store in "connstat" table @sa connstat_rows_count
-    const int32_t CONNS_DB_LIMIT;
-    /// When CONNS_DB_LIMIT reached drop this count of old connstat rows @sa connstat_rows_count
+    /// Drop this count of old connstat rows per eviction step @sa connstat_rows_count
     const int32_t OLD_CONNS_REMOVE_CHUNK;
+
+    /// Background evictor @sa start_evictor
+    example_thread * evictor;
+    example_event evictor_wakeup;
+    std::atomic<bool> evictor_stopping;
+    /// How often the evictor checks usage without being woken
+    const int32_t EVICTOR_INTERVAL_MS;
+    /// Eviction passes run, and passes needed inline before an insert
+    int64_t evictions;
+    int64_t inline_evictions;
+
+    /// Periodic snapshots @sa start_snapshots
+    example_thread * snapshotter;
+    example_event snapshot_wakeup;
+    std::atomic<bool> snapshot_stopping;
+    std::string snapshot_uri;
+    int32_t snapshot_interval_ms;
+
+    typedef std::unordered_map<io_stat_key_t, int64_t, io_stat_key_hash> io_stat_buffer_t;
+    /// io_bytes collected per connection since the last flush @sa sdb_collect_io_stat
+    io_stat_buffer_t pending_io_stats;
+    /// Samples collected since the last flush
+    int32_t pending_samples;
+    /// Time of the last flush
+    std::chrono::steady_clock::time_point last_flush;
+    /// Flush buffered statistics after this many samples @sa pending_samples
+    const int32_t FLUSH_SAMPLES;
+    /// Flush buffered statistics at least this often @sa last_flush
+    const int32_t FLUSH_INTERVAL_MS;
+
+    typedef std::unordered_map<std::string, int32_t> host_cache_t;
+    /// hostip to hostid for rows in 'hosts' table, kept in step with
+    /// sdb_add_host and sdb_remove_old_hosts @sa sdb_find_host_by_ip
+    host_cache_t host_cache;
+    /// Maximum entries in host_cache
+    const size_t HOST_CACHE_LIMIT;
+    /// Lookups answered by host_cache and lookups that reached the database
+    int64_t host_cache_hits;
+    int64_t host_cache_misses;
 };
 
-int
-example_main(int argc, char* argv[])
+/// @brief Sharded variant of ManageMemoryCache for collecting on several cores.
+///
+///  Hosts are partitioned by a hash of their IP across 'shard_count' memory
+///  storage databases. Each shard is owned by one worker thread, which takes
+///  samples from its own lock-free queue and writes them through its own
+///  ManageMemoryCache, so writers never wait for each other's table locks.
+///
+///  A host always maps to the same shard, so its statistics are complete
+///  within that shard, and the merged read view is the union of all shards.
+class ShardedMemoryCache
 {
-    int rc;
-    int64_t rows_affected;
+public:
+    /// @param database_uri
+    ///  Shard 'i' is created as "<database_uri>.<i>".
+    /// @param row_sizes
+    ///  Row sizes measured once for all shards, or NULL to use estimates.
+    /// @param queue_capacity
+    ///  Samples that can wait for each shard before submit() blocks.
+    ShardedMemoryCache(const char * database_uri, int shard_count, const row_sizes_t * row_sizes,
+                       size_t queue_capacity = 4096);
 
-    const char * database_uri = EXAMPLE_DATABASE;
-    if (argc > 1) {
-        database_uri = argv[1];
-    }
+    /// Stop workers and close shard databases
+    ~ShardedMemoryCache();
 
-    storage::ittiadb::Connection database(database_uri);
+    /// Create shard databases and start worker threads.
+    int  start();
+    /// Queue a sample for the shard that owns its host.
+    int  submit(const io_stat_row_t& io_stat);
+    /// Write all queued samples and stop the workers. Returns the first
+    /// error reported by any shard.
+    int  stop();
+    /// Merged read view: summary statistics of hosts from all shards.
+    int  read_hosts(std::vector<host_summary_t>& hosts);
+    /// Print samples handled and storage usage of each shard.
+    void print_stats() const;
 
-    /// Init storage configuration with default settings
-    storage::ittiadb::Connection::MemoryStorageConfig memory_storage_config;
-    /// Create database with custom page size;
-    memory_storage_config.memory_page_size = DB_DEF_PAGE_SIZE * 4 /*DB_MIN_PAGE_SIZE*/;
-    memory_storage_config.memory_storage_size = memory_storage_config.memory_page_size * 100;
-    /// Create a new database file
-    if(DB_NOERROR != GET_ECODE(rc, 
-        database.open(storage::ittiadb::Connection::CreateAlways, memory_storage_config),
-        "Database open failed "))
+private:
+    ShardedMemoryCache(const ShardedMemoryCache&);
+    ShardedMemoryCache& operator=(const ShardedMemoryCache&);
+
+    struct shard_t
     {
-        return EXIT_FAILURE;
+        explicit shard_t(size_t queue_capacity)
+            : row_sizes(NULL), database(NULL), cache(NULL), queue(queue_capacity), wakeup(true)
+            , space_ready(true), blocked_producers(0), thread(NULL), stopping(false), rc(DB_NOERROR), samples(0)
+        {}
+
+        std::string database_uri;
+        /// Shared by all shards; NULL to use estimates
+        const row_sizes_t * row_sizes;
+        storage::ittiadb::Connection * database;
+        ManageMemoryCache * cache;
+        example_task_queue<io_stat_row_t> queue;
+        /// Set when the queue becomes non-empty or the shard must stop
+        example_event wakeup;
+        /// Set by the worker after a pop while producers wait for space,
+        /// and when it exits
+        example_event space_ready;
+        std::atomic<int> blocked_producers;
+        /// Set by the worker once its database is ready, or failed
+        example_event ready;
+        example_thread * thread;
+        std::atomic<bool> stopping;
+        std::atomic<int> rc;
+        std::atomic<int64_t> samples;
+    };
+
+    static void shard_proc(void * arg);
+
+private:
+    std::vector<shard_t *> shards;
+};
+
+/// Create the age sequence, starting at 'start'.
+static int create_age_sequence(storage::ittiadb::Connection& database, int64_t start)
+{
+    // Each value taken reserves a block of AGE_SEQ_BLOCK ages
+    char create_sequence[100];
+    sprintf(create_sequence, "CREATE SEQUENCE age_seq START WITH %lld INCREMENT BY %d",
+            (long long)start, (int)AGE_SEQ_BLOCK);
+    if (storage::ittiadb::Query(database, create_sequence).execute() < 0)
+    {
+        std::cerr << "Failed to create age_seq sequence " << std::endl;
+        return DB_FAILURE;
     }
+    return DB_NOERROR;
+}
+
+/// Create 'hosts' and 'connstat' tables with all their indexes.
+static int create_cache_tables(storage::ittiadb::Connection& database)
+{
+    int64_t rows_affected;
 
     //create hosts table
-    rows_affected = storage::ittiadb::Query(database, 
-        "CREATE TABLE hosts("
-        "hostid sint32 NOT NULL,"
-        "hostip ansistr(16) NOT NULL,"
-        "hostname ansistr(50) NULL,"
-        "iostat sint64 NULL,"
-        "conncount sint32 NOT NULL,"
-        "age sint64 NULL,"
-        "CONSTRAINT hosts_pkey PRIMARY KEY(hostid),"
-        "CONSTRAINT hosts_ip_idx UNIQUE(hostip))"
+    rows_affected = storage::ittiadb::Query(database,
+        (std::string("CREATE TABLE hosts(") + HOSTS_COLUMNS_SQL + ","
+         "CONSTRAINT hosts_ip_idx UNIQUE(hostip))").c_str()
         ).execute();
     //create multiset index for hosts table
     rows_affected = (rows_affected >= 0) ? 
@@ -193,18 +507,12 @@ example_main(int argc, char* argv[])
     if (rows_affected < 0)
     {
         std::cerr << "Failed to create hosts table" << std::endl;
-        return EXIT_FAILURE;
+        return DB_FAILURE;
     }
     //Create Connecton statastics table ('connstat')
-    rows_affected = storage::ittiadb::Query(database, 
-        "CREATE TABLE connstat(" 
-        "hostid sint32 NOT NULL,"
-        "dport sint32 NOT NULL," 
-        "sport uint32 NOT NULL," 
-        "iostat uint64 NULL,"
-        "age sint32 NULL,"
-        "CONSTRAINT cs_pkey PRIMARY KEY(hostid, dport, sport),"
-        "CONSTRAINT cs_hostid_fkey FOREIGN KEY(hostid) references hosts(hostid))"
+    rows_affected = storage::ittiadb::Query(database,
+        (std::string("CREATE TABLE connstat(") + CONNSTAT_COLUMNS_SQL + ","
+         "CONSTRAINT cs_hostid_fkey FOREIGN KEY(hostid) references hosts(hostid))").c_str()
         ).execute();
     //create multiset index
     rows_affected = (rows_affected >= 0) ?
@@ -215,60 +523,818 @@ example_main(int argc, char* argv[])
     if (rows_affected < 0)
     {
         std::cerr << "Failed to create constat table" << std::endl;
-        return EXIT_FAILURE;
+        return DB_FAILURE;
+    }
+    return DB_NOERROR;
+}
+
+/// Open a new memory storage database and create the cache schema in it.
+static int create_cache_database(storage::ittiadb::Connection& database, int64_t& memory_storage_size)
+{
+    int rc;
+
+    /// Init storage configuration with default settings
+    storage::ittiadb::Connection::MemoryStorageConfig memory_storage_config;
+    /// Create database with custom page size;
+    memory_storage_config.memory_page_size = MEMORY_PAGE_SIZE /*DB_MIN_PAGE_SIZE*/;
+    memory_storage_config.memory_storage_size = MEMORY_PAGE_SIZE * MEMORY_STORAGE_PAGES;
+    memory_storage_size = memory_storage_config.memory_storage_size;
+    /// Create a new database file
+    if(DB_NOERROR != GET_ECODE(rc, 
+        database.open(storage::ittiadb::Connection::CreateAlways, memory_storage_config),
+        "Database open failed "))
+    {
+        return rc;
+    }
+
+    if (DB_NOERROR != (rc = create_cache_tables(database)))
+    {
+        return rc;
     }
     // Create Sequence
-    rows_affected = storage::ittiadb::Query(database, "CREATE SEQUENCE age_seq START WITH 1").execute();
-    if (rows_affected < 0)
+    return create_age_sequence(database, 1);
+}
+
+/// Fills 'hosts', or 'connstat' for a single host, of the cache schema with
+/// rows shaped like the ones sdb_add_host and sdb_inc_conn_stat insert.
+class cache_table_filler : public example_storage_filler
+{
+public:
+    explicit cache_table_filler(bool fill_connstat) : fill_connstat(fill_connstat) {}
+
+    int create_schema(storage::ittiadb::Connection& scratch)
+    {
+        int rc = create_cache_tables(scratch);
+        if (DB_NOERROR == rc
+            && fill_connstat
+            && storage::ittiadb::Query(scratch,
+                "INSERT INTO hosts(age, hostid, hostip, iostat, conncount) VALUES(0, 0, '10.0.0.0', 0, 0)"
+                ).execute() < 0)
+        {
+            rc = storage::data::Environment::error().code;
+            EXAMPLE_LOG_ERROR("(measure): Couldn't insert host of scratch connections "
+                << storage::data::Environment::error());
+        }
+        return rc;
+    }
+
+    const char * insert_sql() const
+    {
+        return fill_connstat
+            ? "INSERT INTO connstat(hostid, dport, sport, iostat, age) VALUES(0, ?, ?, ?, ?)"
+            : "INSERT INTO hosts(age, hostid, hostip, iostat, conncount) VALUES(?, ?, ?, ?, 0)";
+    }
+
+    void set_row(int64_t row_number, storage::data::Row& param_row)
+    {
+        if (fill_connstat) {
+            param_row[0].set((int32_t)(row_number % PORTS_COUNT));  //dport
+            param_row[1].set(row_number);                           //sport
+            param_row[2].set(row_number);                           //iostat
+            param_row[3].set((int32_t)row_number);                  //age
+        }
+        else {
+            char hostip[MAX_IP_LEN];
+            sprintf(hostip, "192.%d.%d.%d", (int)(row_number / 240 / 240 % 240 + 10),
+                    (int)(row_number / 240 % 240 + 10), (int)(row_number % 240 + 10));
+            param_row[0].set(row_number);           //age
+            param_row[1].set((int32_t)row_number);  //hostid
+            param_row[2].set(hostip);               //hostip
+            param_row[3].set(row_number);           //iostat
+        }
+    }
+
+private:
+    const bool fill_connstat;
+};
+
+/// Measure the storage taken by the empty schema and by each row of
+/// 'hosts' and 'connstat'. Scratch memory storages named 'scratch_uri' are
+/// filled with rows until they run out of pages, with 'page_size' byte
+/// pages.
+static int measure_row_sizes(const std::string& scratch_uri, int64_t page_size, row_sizes_t& sizes)
+{
+    int rc = DB_NOERROR;
+    int64_t hosts_fixed = 0;
+    int64_t conns_fixed = 0;
+    cache_table_filler hosts(false);
+    cache_table_filler conns(true);
+
+    if (DB_NOERROR != (rc = example_measure_row_bytes(scratch_uri.c_str(), hosts, page_size, MEMORY_STORAGE_PAGES,
+                                                      sizes.host_row_bytes, hosts_fixed))
+        || DB_NOERROR != (rc = example_measure_row_bytes(scratch_uri.c_str(), conns, page_size, MEMORY_STORAGE_PAGES,
+                                                         sizes.conn_row_bytes, conns_fixed)))
+    {
+        EXAMPLE_LOG_ERROR("(measure): Couldn't fill " << scratch_uri);
+        return rc;
+    }
+    // Both fills create the whole schema; the hosts fill has no extra row
+    sizes.fixed_bytes = (double)hosts_fixed;
+    EXAMPLE_LOG_INFO("(measure): " << (int64_t)sizes.host_row_bytes << " bytes per host, "
+        << (int64_t)sizes.conn_row_bytes << " bytes per connection, "
+        << (int64_t)sizes.fixed_bytes << " bytes for the empty schema");
+    return rc;
+}
+
+/// Collect statistics into 'shard_count' databases from as many threads.
+static int run_sharded(const char * database_uri, int shard_count, const row_sizes_t * row_sizes);
+
+int
+example_main(int argc, char* argv[])
+{
+    int rc;
+    int64_t rows_affected;
+
+    const char * database_uri = EXAMPLE_DATABASE;
+    if (argc > 1) {
+        database_uri = argv[1];
+    }
+
+    // Every cache, and every shard, has the same page size, so the row
+    // sizes are measured once
+    row_sizes_t row_sizes;
+    const bool measured = DB_NOERROR == measure_row_sizes(std::string(database_uri) + ".measure",
+                                                          MEMORY_PAGE_SIZE, row_sizes);
+    if (!measured) {
+        std::cerr << "Couldn't measure row sizes, using estimates" << std::endl;
+    }
+
+    if (argc > 2) {
+        // Sharded multi-writer mode
+        return run_sharded(database_uri, atoi(argv[2]), measured ? &row_sizes : NULL);
+    }
+
+    storage::ittiadb::Connection database(database_uri);
+    int64_t memory_storage_size = 0;
+    if (DB_NOERROR != (rc = create_cache_database(database, memory_storage_size)))
     {
-        std::cerr << "Failed to create age_seq sequence " << std::endl;
         return EXIT_FAILURE;
     }
+
+    // Warm restart from the snapshot of the previous run, if any
+    const std::string snapshot_uri = std::string(database_uri) + ".snapshot";
+    ManageMemoryCache cacheMgr(database, memory_storage_size);
+    if (measured) {
+        cacheMgr.set_row_sizes(row_sizes);
+    }
+    rc = cacheMgr.sdb_load_snapshot(snapshot_uri);
+    if (DB_ENOTFOUND == rc) {
+        std::cout << "No snapshot found, starting with an empty cache" << std::endl;
+    }
+    else if (DB_NOERROR != rc) {
+        std::cerr << "Couldn't load snapshot, starting with an empty cache" << std::endl;
+    }
+
     // Start traffic statistics generation
     int i = 0;
     io_stat_row_t r;
-    ManageMemoryCache cacheMgr(database);
+    cacheMgr.start_evictor();
+    cacheMgr.start_snapshots(snapshot_uri, 1000);
     rc = DB_NOERROR;
     for (i = 0; (i < 50000) && (DB_NOERROR == rc); ++i) {
         //io_stat_row_t r;
-        cacheMgr.generate_iostat_row(r, i);
-        rc = cacheMgr.sdb_inc_io_stat(r);
+        ManageMemoryCache::generate_iostat_row(r, i);
+        rc = cacheMgr.sdb_collect_io_stat(r);
+    }
+    if (DB_NOERROR == rc) {
+        rc = cacheMgr.sdb_flush_io_stats();
+    }
+    cacheMgr.stop_snapshots();
+    cacheMgr.stop_evictor();
+    if (DB_NOERROR == rc) {
+        rc = cacheMgr.sdb_save_snapshot(snapshot_uri);
     }
+    // Reports below go straight to std::cout
+    example_log_flush();
+    cacheMgr.print_host_cache_stats();
+    cacheMgr.print_memory_usage();
     if (DB_NOERROR != rc)
     {
-        std::cerr << " Stat collection failed" << std::endl;
-        return EXIT_FAILURE;
+        std::cerr << " Stat collection failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    //Drop sequence
+    rows_affected = storage::ittiadb::Query(database, "DROP SEQUENCE age_seq").execute();
+    if (rows_affected < 0)
+    {
+        std::cerr << "Failed to drop age_seq" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Enter SQL statements or an empty line to exit" << std::endl;
+    sql_line_shell(database);
+
+   return rc;
+}
+
+ManageMemoryCache::ManageMemoryCache(storage::ittiadb::Connection& database, int64_t memory_storage_size)
+    :db(database)
+    , tables_open(false)
+    , hosts_by_id(database, "hosts")
+    , hosts_by_ip(database, "hosts")
+    , conns_by_key(database, "connstat")
+    , insert_host(database,
+        "INSERT INTO "
+        "hosts(age, hostid, hostip, iostat,conncount) "
+        "VALUES(?,?,?,?,0)")
+    , update_conn(database,
+        " UPDATE connstat "
+        " SET age = ?,"
+        " iostat = iostat + ?"
+        " WHERE hostid =? AND dport =? AND sport =? ")
+    , insert_conn(database,
+        "INSERT INTO "
+        "connstat(hostid, dport, sport, iostat,age) "
+        "VALUES(?,?,?,?,?)")
+    , age_seq(database, "age_seq", AGE_SEQ_BLOCK)
+    , db_mutex()
+    , hosts_rows_count(0)
+    , connstat_rows_count(0)
+    , MEMORY_STORAGE_SIZE(memory_storage_size)
+    // Row payload plus one entry per index, rounded up; replaced by
+    // set_row_sizes
+    , fixed_bytes(0)
+    , host_row_bytes(192)
+    , conn_row_bytes(96)
+    , HIGH_WATERMARK_PCT(80)
+    , LOW_WATERMARK_PCT(60)
+    , HARD_LIMIT_PCT(95)
+    , OLD_HOSTS_REMOVE_CHUNK(10)
+    , OLD_CONNS_REMOVE_CHUNK(20)
+    , evictor(NULL)
+    , evictor_wakeup(true)
+    , evictor_stopping(false)
+    , EVICTOR_INTERVAL_MS(50)
+    , evictions(0)
+    , inline_evictions(0)
+    , snapshotter(NULL)
+    , snapshot_wakeup(true)
+    , snapshot_stopping(false)
+    , snapshot_uri()
+    , snapshot_interval_ms(0)
+    , pending_io_stats()
+    , pending_samples(0)
+    , last_flush(std::chrono::steady_clock::now())
+    , FLUSH_SAMPLES(200)
+    , FLUSH_INTERVAL_MS(100)
+    , host_cache()
+    , HOST_CACHE_LIMIT(HOSTS_COUNT)
+    , host_cache_hits(0)
+    , host_cache_misses(0)
+{
+    //Empty
+}
+
+ManageMemoryCache::~ManageMemoryCache() 
+{
+    stop_snapshots();
+    stop_evictor();
+    sdb_close_tables_();
+}
+
+void
+ManageMemoryCache::set_row_sizes(const row_sizes_t& sizes)
+{
+    std::lock_guard<std::mutex> lock(db_mutex);
+    fixed_bytes = sizes.fixed_bytes;
+    host_row_bytes = sizes.host_row_bytes;
+    conn_row_bytes = sizes.conn_row_bytes;
+}
+
+void
+ManageMemoryCache::start_evictor()
+{
+    if (NULL == evictor) {
+        evictor_stopping.store(false);
+        evictor = new example_thread(evictor_proc, this);
+    }
+}
+
+void
+ManageMemoryCache::stop_evictor()
+{
+    if (NULL != evictor) {
+        evictor_stopping.store(true);
+        evictor_wakeup.set();
+        evictor->join();
+        delete evictor;
+        evictor = NULL;
+    }
+}
+
+void
+ManageMemoryCache::evictor_proc(void * arg)
+{
+    ManageMemoryCache * cache = static_cast<ManageMemoryCache *>(arg);
+
+    while (!cache->evictor_stopping.load()) {
+        (void)cache->evictor_wakeup.wait_for_milliseconds(cache->EVICTOR_INTERVAL_MS);
+        if (cache->evictor_stopping.load()) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(cache->db_mutex);
+        if (cache->storage_used_pct_() >= cache->HIGH_WATERMARK_PCT) {
+            (void)cache->sdb_evict_(cache->LOW_WATERMARK_PCT);
+        }
+        // sdb_collect_io_stat only checks the flush interval when a sample
+        // arrives; write samples left waiting by a pause in traffic
+        if (cache->pending_samples > 0
+            && std::chrono::steady_clock::now() - cache->last_flush
+               >= std::chrono::milliseconds(cache->FLUSH_INTERVAL_MS))
+        {
+            (void)cache->sdb_flush_io_stats_();
+        }
+    }
+}
+
+int
+ManageMemoryCache::storage_used_pct_() const
+{
+    const double used = fixed_bytes + hosts_rows_count * host_row_bytes + connstat_rows_count * conn_row_bytes;
+    return (int)(used * 100 / (double)MEMORY_STORAGE_SIZE);
+}
+
+int
+ManageMemoryCache::sdb_evict_to_(int target_pct)
+{
+    int rc = DB_NOERROR;
+
+    while (DB_NOERROR == rc && storage_used_pct_() > target_pct && hosts_rows_count > 0) {
+        const int hosts_before = hosts_rows_count;
+        const int conns_before = connstat_rows_count;
+
+        // Take from whichever table holds more of the usage
+        if (connstat_rows_count > 0
+            && connstat_rows_count * conn_row_bytes >= hosts_rows_count * host_row_bytes)
+        {
+            rc = sdb_remove_old_conns(OLD_CONNS_REMOVE_CHUNK);
+        }
+        else {
+            rc = sdb_remove_old_hosts(OLD_HOSTS_REMOVE_CHUNK);
+        }
+        if (hosts_before == hosts_rows_count && conns_before == connstat_rows_count) {
+            // Nothing left to delete; row counts are out of step with the tables
+            break;
+        }
+    }
+    return rc;
+}
+
+int
+ManageMemoryCache::sdb_evict_(int target_pct)
+{
+    int rc = DB_NOERROR;
+
+    int save_hosts_rows_count = hosts_rows_count;
+    int save_connstat_rows_count = connstat_rows_count;
+    storage::ittiadb::Transaction txn(db);
+    GET_ECODE(rc, txn.begin(), "(evict):Couldn't begin Transaction: ");
+    if (DB_NOERROR == rc) {
+        rc = sdb_open_tables_();
+    }
+    if (DB_NOERROR == rc) {
+        rc = sdb_evict_to_(target_pct);
+    }
+    if (DB_NOERROR == rc) {
+        GET_ECODE(rc, txn.commit(), "(evict):Couldn't commit transaction: ");
+    }
+    if (DB_NOERROR == rc) {
+        ++evictions;
+        EXAMPLE_LOG_INFO("(evict): storage usage " << storage_used_pct_() << "% after removing "
+            << save_hosts_rows_count - hosts_rows_count << " hosts and "
+            << save_connstat_rows_count - connstat_rows_count << " connections");
+    }
+    else {
+        sdb_rollback_(txn, rc, save_hosts_rows_count, save_connstat_rows_count);
+    }
+    return rc;
+}
+
+void
+ManageMemoryCache::sdb_rollback_(storage::ittiadb::Transaction& txn, int rc,
+                                 int save_hosts_rows_count, int save_connstat_rows_count)
+{
+    if (DB_ENOPAGESPACE == rc || DB_ENOMEM == rc) {
+        // The rows present when the storage filled up take all of it:
+        // scale the per-row sizes to match
+        const double used = hosts_rows_count * host_row_bytes + connstat_rows_count * conn_row_bytes;
+        if (used > 0 && fixed_bytes + used < (double)MEMORY_STORAGE_SIZE) {
+            const double scale = ((double)MEMORY_STORAGE_SIZE - fixed_bytes) / used;
+            host_row_bytes *= scale;
+            conn_row_bytes *= scale;
+        }
+        EXAMPLE_LOG_WARN("No memory left. Row sizes corrected to " << (int64_t)host_row_bytes
+            << " bytes per host and " << (int64_t)conn_row_bytes << " bytes per connection");
+    }
+    txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+    hosts_rows_count = save_hosts_rows_count;
+    connstat_rows_count = save_connstat_rows_count;
+    host_cache_invalidate();
+    sdb_close_tables_();
+}
+
+void
+ManageMemoryCache::start_snapshots(const std::string& snapshot_uri, int32_t interval_ms)
+{
+    if (NULL == snapshotter) {
+        this->snapshot_uri = snapshot_uri;
+        snapshot_interval_ms = interval_ms;
+        snapshot_stopping.store(false);
+        snapshotter = new example_thread(snapshot_proc, this);
+    }
+}
+
+void
+ManageMemoryCache::stop_snapshots()
+{
+    if (NULL != snapshotter) {
+        snapshot_stopping.store(true);
+        snapshot_wakeup.set();
+        snapshotter->join();
+        delete snapshotter;
+        snapshotter = NULL;
+    }
+}
+
+void
+ManageMemoryCache::snapshot_proc(void * arg)
+{
+    ManageMemoryCache * cache = static_cast<ManageMemoryCache *>(arg);
+
+    while (!cache->snapshot_stopping.load()) {
+        if (cache->snapshot_wakeup.wait_for_milliseconds(cache->snapshot_interval_ms)) {
+            // Woken by stop_snapshots()
+            continue;
+        }
+        (void)cache->sdb_save_snapshot(cache->snapshot_uri);
+    }
+}
+
+int
+ManageMemoryCache::sdb_copy_to_image_(const char * table_name, const char * index_name, int key_fields,
+                                      storage::ittiadb::Table& image_table, int64_t& rows,
+                                      std::chrono::steady_clock::duration& locked)
+{
+    int rc = DB_NOERROR;
+    storage::ittiadb::Table source(db, table_name);
+    std::vector<storage::data::SingleRow *> chunk;
+    size_t chunk_rows = 0;
+
+    rows = 0;
+    std::unique_lock<std::mutex> lock(db_mutex, std::defer_lock);
+    std::chrono::steady_clock::time_point locked_at = std::chrono::steady_clock::now();
+    lock.lock();
+    if (DB_NOERROR != GET_ECODE(rc, source.open(index_name),
+                                "(save_snapshot): Couldn't open table to copy "))
+    {
+        return rc;
+    }
+    RowCursor cursor(source, key_fields, SNAPSHOT_BATCH);
+    for (RowCursor::iterator row = cursor.begin(); ; ++row) {
+        if (row != cursor.end()) {
+            if (chunk.size() == chunk_rows) {
+                chunk.push_back(new storage::data::SingleRow(source.columns()));
+            }
+            *chunk[chunk_rows++] = *row;
+            if (chunk_rows < SNAPSHOT_BATCH) {
+                continue;
+            }
+        }
+
+        // The cursor reads the next chunk under the lock; write this one
+        // to the image without holding up the writers
+        lock.unlock();
+        locked += std::chrono::steady_clock::now() - locked_at;
+        for (size_t i = 0; i < chunk_rows && DB_NOERROR == rc; ++i) {
+            GET_ECODE(rc, image_table.insert(*chunk[i]), "(save_snapshot): Couldn't write row ");
+        }
+        rows += (int64_t)chunk_rows;
+        chunk_rows = 0;
+        if (DB_NOERROR != rc || row == cursor.end()) {
+            break;
+        }
+        locked_at = std::chrono::steady_clock::now();
+        lock.lock();
+    }
+    if (DB_NOERROR == rc && DB_NOERROR != cursor.error()) {
+        rc = cursor.error();
+        EXAMPLE_LOG_ERROR("(save_snapshot): Couldn't read " << table_name << " :: "
+            << storage::data::Environment::error());
+    }
+
+    lock.lock();
+    (void)source.close();
+    lock.unlock();
+    for (size_t i = 0; i < chunk.size(); ++i) {
+        delete chunk[i];
+    }
+    return rc;
+}
+
+int
+ManageMemoryCache::sdb_save_snapshot(const std::string& snapshot_uri)
+{
+    int rc = DB_NOERROR;
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration locked = std::chrono::steady_clock::duration::zero();
+    int64_t host_rows = 0;
+    int64_t conn_rows = 0;
+
+    // Write a new image next to the old one, so a crash never leaves a
+    // half-written snapshot. The image only has primary keys, which are
+    // enough to load it in order.
+    const std::string temp_uri = snapshot_uri + ".tmp";
+    storage::ittiadb::Connection image(temp_uri.c_str());
+    GET_ECODE(rc, image.open(storage::ittiadb::Connection::CreateAlways),
+              "(save_snapshot): Couldn't create snapshot image ");
+    if (DB_NOERROR == rc
+        && (storage::ittiadb::Query(image,
+                (std::string("CREATE TABLE hosts(") + HOSTS_COLUMNS_SQL + ")").c_str()).execute() < 0
+            || storage::ittiadb::Query(image,
+                (std::string("CREATE TABLE connstat(") + CONNSTAT_COLUMNS_SQL + ")").c_str()).execute() < 0))
+    {
+        rc = DB_FAILURE;
+        EXAMPLE_LOG_ERROR("(save_snapshot): Couldn't create snapshot tables "
+            << storage::data::Environment::error());
+    }
+
+    // Copy the tables a chunk at a time; the cache is locked only while a
+    // chunk is read. Connections are copied before hosts, so a host evicted
+    // in between leaves orphan connections, which sdb_load_snapshot skips,
+    // rather than connections missing from a saved host.
+    if (DB_NOERROR == rc)
+    {
+        storage::ittiadb::Transaction txn(image);
+        storage::ittiadb::Table hosts_image(image, "hosts");
+        storage::ittiadb::Table conns_image(image, "connstat");
+        if (DB_NOERROR == GET_ECODE(rc, txn.begin(), "(save_snapshot): Couldn't begin Transaction: ")
+            && DB_NOERROR == GET_ECODE(rc, hosts_image.open(storage::ittiadb::Table::Exclusive))
+            && DB_NOERROR == GET_ECODE(rc, conns_image.open(storage::ittiadb::Table::Exclusive))
+            && DB_NOERROR == (rc = sdb_copy_to_image_("connstat", "cs_pkey", 3, conns_image, conn_rows, locked))
+            && DB_NOERROR == (rc = sdb_copy_to_image_("hosts", "hosts_pkey", 1, hosts_image, host_rows, locked)))
+        {
+            (void)hosts_image.close();
+            (void)conns_image.close();
+            GET_ECODE(rc, txn.commit(), "(save_snapshot): Couldn't commit transaction: ");
+        }
+        else
+        {
+            txn.rollback(storage::ittiadb::Transaction::ForcedCompletion);
+        }
+    }
+    if (image.isOpen()) {
+        (void)image.close();
+    }
+    if (DB_NOERROR != rc) {
+        (void)image.remove();
+        return rc;
+    }
+
+    // Replace the previous snapshot
+    if (0 != rename(temp_uri.c_str(), snapshot_uri.c_str())) {
+        (void)storage::ittiadb::Connection(snapshot_uri.c_str()).remove();
+        if (0 != rename(temp_uri.c_str(), snapshot_uri.c_str())) {
+            EXAMPLE_LOG_ERROR("(save_snapshot): Couldn't replace " << snapshot_uri);
+            return DB_FAILURE;
+        }
+    }
+
+    long image_bytes = 0;
+    FILE * image_file = fopen(snapshot_uri.c_str(), "rb");
+    if (NULL != image_file) {
+        if (0 == fseek(image_file, 0, SEEK_END)) {
+            image_bytes = ftell(image_file);
+        }
+        fclose(image_file);
+    }
+    const std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+    EXAMPLE_LOG_INFO("(save_snapshot): " << host_rows << " hosts, " << conn_rows
+        << " connections, " << image_bytes << " bytes in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(finished - started).count() << " ms ("
+        << std::chrono::duration_cast<std::chrono::milliseconds>(locked).count()
+        << " ms holding the cache)");
+    return rc;
+}
+
+int
+ManageMemoryCache::sdb_load_from_image_(storage::ittiadb::Connection& image, const char * table_name,
+                                        const char * index_name, int key_fields, bool skip_orphans,
+                                        storage::ittiadb::Table& target, int64_t& rows, int64_t& max_age)
+{
+    int rc = DB_NOERROR;
+    storage::ittiadb::Table source(image, table_name);
+
+    rows = 0;
+    if (DB_NOERROR != GET_ECODE(rc, source.open(index_name),
+                                "(load_snapshot): Couldn't open snapshot table "))
+    {
+        return rc;
+    }
+    storage::data::SingleRow host_key(hosts_by_id.columns());
+    storage::data::SingleRow host(hosts_by_id.columns());
+    RowCursor cursor(source, key_fields, SNAPSHOT_BATCH);
+    for (RowCursor::iterator row = cursor.begin(); DB_NOERROR == rc && row != cursor.end(); ++row) {
+        if (skip_orphans) {
+            // A host evicted while the snapshot was saved leaves its
+            // connections behind
+            int32_t hostid = 0;
+            (*row)["hostid"].get(hostid);
+            host_key["hostid"].set(hostid);
+            if (DB_OK != hosts_by_id.search_by_index(DB_SEEK_FIRST_EQUAL, host_key, 1, host)) {
+                if (storage::data::Environment::is_error(DB_ENOTFOUND)) {
+                    continue;
+                }
+                rc = storage::data::Environment::error().code;
+                EXAMPLE_LOG_ERROR("(load_snapshot): Couldn't look up host " << hostid << " :: "
+                    << storage::data::Environment::error());
+                break;
+            }
+        }
+        int64_t age = 0;
+        (*row)["age"].get(age);
+        max_age = age > max_age ? age : max_age;
+        if (DB_NOERROR == GET_ECODE(rc, target.insert(*row), "(load_snapshot): Couldn't load row ")) {
+            ++rows;
+        }
+    }
+    if (DB_NOERROR == rc && DB_NOERROR != cursor.error()) {
+        rc = cursor.error();
+        EXAMPLE_LOG_ERROR("(load_snapshot): Couldn't read " << table_name << " :: "
+            << storage::data::Environment::error());
+    }
+    (void)source.close();
+    return rc;
+}
+
+int
+ManageMemoryCache::sdb_load_snapshot(const std::string& snapshot_uri)
+{
+    int rc = DB_NOERROR;
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    int64_t host_rows = 0;
+    int64_t conn_rows = 0;
+    // Ages continue after the newest one in the snapshot
+    int64_t max_age = 0;
+
+    storage::ittiadb::Connection image(snapshot_uri.c_str());
+    if (DB_OK != image.open(storage::ittiadb::Connection::OpenExisting)) {
+        return DB_ENOTFOUND;
+    }
+
+    // Rows are streamed from the image a chunk at a time, so memory doesn't
+    // grow with the snapshot. Hosts first, so connections find their host
+    // on insert.
+    std::lock_guard<std::mutex> lock(db_mutex);
+    storage::ittiadb::Transaction txn(db);
+    if (DB_NOERROR == GET_ECODE(rc, txn.begin(), "(load_snapshot): Couldn't begin Transaction: ")
+        && DB_NOERROR == (rc = sdb_open_tables_())
+        && DB_NOERROR == (rc = sdb_load_from_image_(image, "hosts", "hosts_pkey", 1, false,
+                                                    hosts_by_id, host_rows, max_age))
+        && DB_NOERROR == (rc = sdb_load_from_image_(image, "connstat", "cs_pkey", 3, true,
+                                                    conns_by_key, conn_rows, max_age))
+        && DB_NOERROR == GET_ECODE(rc, txn.commit(), "(load_snapshot): Couldn't commit transaction: "))
+    {
+        hosts_rows_count = (int)host_rows;
+        connstat_rows_count = (int)conn_rows;
+    }
+    else
+    {
+        sdb_rollback_(txn, rc, 0, 0);
+        (void)image.close();
+        return rc;
+    }
+    (void)image.close();
+
+    if (max_age > 0)
+    {
+        if (DB_NOERROR == GET_ECODE(rc, storage::ittiadb::Query(db, "DROP SEQUENCE age_seq").execute(),
+                                    "(load_snapshot): Couldn't drop age_seq "))
+        {
+            rc = create_age_sequence(db, max_age + 1);
+        }
+        age_seq.reset();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    const int64_t rows = host_rows + conn_rows;
+    EXAMPLE_LOG_INFO("(load_snapshot): " << host_rows << " hosts, " << conn_rows
+        << " connections in " << (int64_t)(seconds * 1000) << " ms ("
+        << (seconds > 0 ? (int64_t)(rows / seconds) : 0) << " rows/s)");
+    return rc;
+}
+
+int
+ManageMemoryCache::sdb_read_hosts(std::vector<host_summary_t>& hosts)
+{
+    int rc = DB_NOERROR;
+    std::lock_guard<std::mutex> lock(db_mutex);
+
+    storage::ittiadb::Query select(db, "SELECT hostip, iostat, conncount FROM hosts");
+    storage::data::RowSet<> rows;
+    if (DB_NOERROR == GET_ECODE(rc, select.execute(rows), "(read_hosts): Couldn't read hosts table "))
+    {
+        storage::data::RowSet<>::const_iterator iter = rows.begin();
+        for (; iter != rows.end(); ++iter) {
+            host_summary_t host;
+            (*iter)["hostip"].get(host.hostip);
+            (*iter)["iostat"].get(host.iostat);
+            (*iter)["conncount"].get(host.conncount);
+            hosts.push_back(host);
+        }
     }
+    return rc;
+}
 
-    //Drop sequence
-    rows_affected = storage::ittiadb::Query(database, "DROP SEQUENCE age_seq").execute();
-    if (rows_affected < 0)
+void
+ManageMemoryCache::print_memory_usage() const
+{
+    std::lock_guard<std::mutex> lock(db_mutex);
+    std::cout << "Memory storage: ~" << storage_used_pct_() << "% of " << MEMORY_STORAGE_SIZE
+        << " bytes used by " << hosts_rows_count << " hosts and " << connstat_rows_count
+        << " connections; " << evictions << " evictions, " << inline_evictions
+        << " of them inline" << std::endl;
+}
+
+int
+ManageMemoryCache::sdb_open_tables_()
+{
+    int rc = DB_NOERROR;
+    if (tables_open) {
+        return rc;
+    }
+    if (DB_NOERROR == GET_ECODE(rc, hosts_by_id.open("hosts_pkey"),
+                                "(open_tables): Couldn't open hosts table on hosts_pkey: ")
+        && DB_NOERROR == GET_ECODE(rc, hosts_by_ip.open("hosts_ip_idx"),
+                                   "(open_tables): Couldn't open hosts table on hosts_ip_idx: ")
+        && DB_NOERROR == GET_ECODE(rc, conns_by_key.open("cs_pkey"),
+                                   "(open_tables): Couldn't open connstat table on cs_pkey: ")
+        && DB_NOERROR == GET_ECODE(rc, insert_host.prepare(),
+                                   "(open_tables): Error preparing hosts insert Query: ")
+        && DB_NOERROR == GET_ECODE(rc, update_conn.prepare(),
+                                   "(open_tables): Query Update connstat row prepare failed ")
+        && DB_NOERROR == GET_ECODE(rc, insert_conn.prepare(),
+                                   "(open_tables): Query Insert connstat row prepare failed "))
     {
-        std::cerr << "Failed to drop age_seq" << std::endl;
-        return EXIT_FAILURE;
+        tables_open = true;
     }
+    else
+    {
+        sdb_close_tables_();
+    }
+    return rc;
+}
 
-    std::cout << "Enter SQL statements or an empty line to exit" << std::endl;
-    sql_line_shell(database);
-
-   return rc;
+void
+ManageMemoryCache::sdb_close_tables_()
+{
+    (void)insert_conn.close();
+    (void)update_conn.close();
+    (void)insert_host.close();
+    (void)conns_by_key.close();
+    (void)hosts_by_ip.close();
+    (void)hosts_by_id.close();
+    tables_open = false;
 }
 
-ManageMemoryCache::ManageMemoryCache(storage::ittiadb::Connection& database)
-    :db(database)
-    , hosts_rows_count(0)
-    , connstat_rows_count(0)
-    , HOSTS_DB_LIMIT(800)
-    , OLD_HOSTS_REMOVE_CHUNK(10)
-    , CONNS_DB_LIMIT((HOSTS_DB_LIMIT * 4))
-    , OLD_CONNS_REMOVE_CHUNK(20)
+int
+ManageMemoryCache::sdb_select_oldest_(const char * select_sql, int count,
+                                      storage::data::RowSet<>& rows, int64_t& max_age)
 {
-    //Empty
+    int rc = DB_NOERROR;
+    storage::ittiadb::Query select(db, select_sql);
+    if (DB_NOERROR == GET_ECODE(rc, select.prepare(), "(select_oldest): Query prepare failed "))
+    {
+        storage::data::SingleRow param_row(select.parameters());
+        param_row[0].set(count);
+        rows.clear();
+        if (DB_NOERROR == GET_ECODE(rc, select.execute_with(param_row, rows),
+                                    "(select_oldest): Couldn't read oldest rows "))
+        {
+            // Ages come from age_seq, so rows up to the last age read are
+            // exactly the rows selected
+            storage::data::RowSet<>::const_iterator iter = rows.begin();
+            for (max_age = 0; iter != rows.end(); ++iter) {
+                (*iter)["age"].get(max_age);
+            }
+        }
+    }
+    return rc;
 }
 
-ManageMemoryCache::~ManageMemoryCache() 
+int
+ManageMemoryCache::sdb_delete_up_to_age_(const char * delete_sql, int64_t max_age, int64_t& rows_deleted)
 {
-    //Empty
+    int rc = DB_NOERROR;
+    storage::ittiadb::Query remove(db, delete_sql);
+    if (DB_NOERROR == GET_ECODE(rc, remove.prepare(), "(delete_up_to_age): Query prepare failed "))
+    {
+        storage::data::SingleRow param_row(remove.parameters());
+        param_row[0].set(max_age);
+        rows_deleted = remove.execute_with(param_row);
+        GET_ECODE(rc, rows_deleted, "(delete_up_to_age): Couldn't delete old rows ");
+    }
+    return rc;
 }
 
 int 
@@ -277,33 +1343,34 @@ ManageMemoryCache::sdb_remove_old_hosts(int count)
     int rc = DB_NOERROR;
     int32_t ccount;
     int32_t hostid;
+    int64_t max_age = 0;
+    int64_t rows_deleted = 0;
 
-    std::cout << "(remove_old_hosts):About to delete " << count
-        << "/" << hosts_rows_count << "hosts" << std::endl;
-
-    storage::ittiadb::Table table(db, "hosts");
+    EXAMPLE_LOG_DEBUG("(remove_old_hosts):About to delete " << count
+        << "/" << hosts_rows_count << "hosts");
 
-    GET_ECODE(rc, table.open("hosts_age_idx"), "Couldn't open the host table");
-    
-    for (; count && (DB_NOERROR == rc); --count) {
-        //Fetch (from record about to be deleted) current connections count, to
-        //recalculate our global 'connstat_rows_count' statistics.
-        storage::data::SingleRow first_row(table.columns());
-        GET_ECODE(rc, table.fetch(first_row),"Couldn't fetch hosts table while deleting hosts");
-
-       if( (DB_NOERROR == rc) && (DB_NOERROR == GET_ECODE(rc, table.delete_by_index(first_row,1), 
-                                     "Couldn't delete row from hosts table") ))
-        {
-            // Delete & decrement [hosts|connstat]_rows_count
-            --hosts_rows_count;
-            // Deletes from hosts table do cascade deletion ( by cascade detete fkey )
-            // from 'connstat' table, so correct 'connstat_rows_count' too
-            first_row["hostid"].get(hostid);
-            first_row["conncount"].get(ccount);
+    //Read (from records about to be deleted) current connections count, to
+    //recalculate our global 'connstat_rows_count' statistics.
+    storage::data::RowSet<> old_hosts;
+    if (DB_NOERROR == (rc = sdb_select_oldest_(
+            "SELECT hostid, hostip, conncount, age FROM hosts"
+            " ORDER BY age FETCH FIRST ? ROWS ONLY",
+            count, old_hosts, max_age))
+        && !old_hosts.empty()
+        && DB_NOERROR == (rc = sdb_delete_up_to_age_("DELETE FROM hosts WHERE age <= ?", max_age, rows_deleted)))
+    {
+        // Deletes from hosts table do cascade deletion ( by cascade detete fkey )
+        // from 'connstat' table, so correct 'connstat_rows_count' too
+        storage::data::RowSet<>::const_iterator iter = old_hosts.begin();
+        for (; iter != old_hosts.end(); ++iter) {
+            (*iter)["hostid"].get(hostid);
+            (*iter)["conncount"].get(ccount);
             connstat_rows_count -= ccount;
-            std::cout << "(remove_old_hosts):(hostid, ccount): ("
-                << hostid << "," << ccount << ") " << first_row << std::endl;
+            host_cache.erase((*iter)["hostip"].to<std::string>());
+            EXAMPLE_LOG_DEBUG("(remove_old_hosts):(hostid, ccount): ("
+                << hostid << "," << ccount << ") " << *iter);
         }
+        hosts_rows_count -= (int)rows_deleted;
     }
     return rc;
 }
@@ -312,53 +1379,47 @@ int
 ManageMemoryCache::sdb_add_host(const char *hostip, int64_t iostat, int32_t& hostid)
 {
     int rc = DB_NOERROR;
-    //row count in table exceeding max limit
-    if (HOSTS_DB_LIMIT <= hosts_rows_count) {
+    int64_t age = 0;
+    //The evictor has fallen behind: make room before inserting
+    if (HARD_LIMIT_PCT <= storage_used_pct_()) {
+        ++inline_evictions;
         rc = sdb_remove_old_hosts(OLD_HOSTS_REMOVE_CHUNK);
     }
+    //Generate age and host id from sequence before inserting, so the new
+    //host id needn't be read back
+    if (DB_NOERROR == rc && DB_NOERROR != (rc = age_seq.next_value(age)))
+    {
+        EXAMPLE_LOG_ERROR("(add_host): Couldn't get next value of age_seq: " << rc);
+    }
     if (DB_NOERROR == rc)
     {
-        storage::ittiadb::Table table(db, "hosts");
+        // Prepared once by sdb_open_tables_
+        storage::ittiadb::Query& insert = insert_host;
+        int64_t rows_affected = 0;
 
-        GET_ECODE(rc, table.open(storage::ittiadb::Table::Exclusive), "(add_host): Error opening table:");
+        storage::data::SingleRow param_row(insert.parameters());
+        param_row[0].set(age);//age
+        param_row[1].set((int32_t)age);//hostid
+        param_row[2].set(hostip);//hostip
+        param_row[3].set(iostat);//iostat
 
-        storage::ittiadb::Query insert(db, 
-            "INSERT INTO " 
-            "hosts(age, hostid, hostip, iostat,conncount) " 
-            "VALUES(NEXT VALUE FOR age_seq, CURRENT VALUE FOR age_seq,?,?,0)"
-            );
-
-        if ((DB_NOERROR == rc)
-            && (DB_NOERROR == GET_ECODE(rc, insert.prepare(),
-                                "(add_host): Error preparing row insert Query: ")))
+        rows_affected = insert.execute_with(param_row);
+        if (1 != rows_affected)
         {
-            int64_t rows_affected = 0;
-
-            storage::data::SingleRow param_row(insert.parameters());
-            param_row[0].set(hostip);//hostip
-            param_row[1].set(iostat);//iostat
-
-            rows_affected = insert.execute_with(param_row);
-            if (1 != rows_affected)
-            {
-                const storage::data::Error& error = storage::data::Environment::error();
-                std::cerr << "(add_host):Couldn't insert hosts table record: " << error << std::endl;
-                rc = error.code;
-            }
-            else
-            {
-                hosts_rows_count++;
-                //Generate age and host id from sequence
-                //get current value for host id                
-                storage::data::SingleField field;
-                storage::ittiadb::Query(db, "SELECT CURRENT VALUE FOR age_seq").execute(field);
-                field.get(hostid);
-            }
-            std::cout << "(add_host): Add Host_" << hosts_rows_count
-                << ": (hostid,age,ip,iostat) = (" << hostid << "," << hostid
-                << "," << hostip << "," << iostat << ")" 
-                /*<< " param_row (ip,iostat) =(" << param_row << ")"*/ << std::endl;
+            const storage::data::Error& error = storage::data::Environment::error();
+            EXAMPLE_LOG_ERROR("(add_host):Couldn't insert hosts table record: " << error);
+            rc = error.code;
+        }
+        else
+        {
+            hosts_rows_count++;
+            hostid = (int32_t)age;
+            host_cache_put(hostip, hostid);
         }
+        EXAMPLE_LOG_DEBUG("(add_host): Add Host_" << hosts_rows_count
+            << ": (hostid,age,ip,iostat) = (" << hostid << "," << hostid
+            << "," << hostip << "," << iostat << ")" 
+            /*<< " param_row (ip,iostat) =(" << param_row << ")"*/);
 
     }
     return rc;
@@ -368,40 +1429,68 @@ int
 ManageMemoryCache::sdb_find_host_by_ip(const char * hostip, int32_t& hostid)
 {
     int rc = DB_NOERROR;
-    db_result_t db_rc = DB_OK;
-    storage::ittiadb::Table table(db, "hosts");
-    db_rc = table.open("hosts_ip_idx");
-    GET_ECODE(rc, table.open("hosts_ip_idx"), "(find_host_by_ip):Open hosts table:");
-    if (DB_NOERROR == rc)
+
+    host_cache_t::const_iterator cached = host_cache.find(hostip);
+    if (cached != host_cache.end()) {
+        ++host_cache_hits;
+        hostid = cached->second;
+        return rc;
+    }
+    ++host_cache_misses;
+
+    storage::ittiadb::Table& table = hosts_by_ip;
+    storage::data::SingleRow key(table.columns());
+    storage::data::SingleRow data(table.columns());
+    key["hostip"].set(hostip);
+    if (DB_NOERROR == 
+        GET_ECODE(rc, table.search_by_index(DB_SEEK_FIRST_EQUAL, key, 1, data)))
     {
-        storage::data::SingleRow key(table.columns());
-        storage::data::SingleRow data(table.columns());
-        key["hostip"].set(hostip);
-        if (DB_NOERROR == 
-            GET_ECODE(rc, table.search_by_index(DB_SEEK_FIRST_EQUAL, key, 1, data)))
-        {
-            //Populate host id from the row found 
-            data["hostid"].get(hostid);
-        }
+        //Populate host id from the row found 
+        data["hostid"].get(hostid);
+        host_cache_put(hostip, hostid);
     }
     if (DB_NOERROR != rc && DB_ENOTFOUND != rc)
     {
-        std::cerr << " sdb_find_host_by_ip failed for find row [" 
-            << hostip<< "," <<hostid <<"] with rc = "<<rc << std::endl;
+        EXAMPLE_LOG_ERROR(" sdb_find_host_by_ip failed for find row [" 
+            << hostip<< "," <<hostid <<"] with rc = "<<rc);
     }
 
     return rc;
 }
 
+void
+ManageMemoryCache::host_cache_put(const char * hostip, int32_t hostid)
+{
+    if (host_cache.size() >= HOST_CACHE_LIMIT) {
+        // Bounded: drop an arbitrary entry; it will be looked up again if needed
+        host_cache.erase(host_cache.begin());
+    }
+    host_cache[hostip] = hostid;
+}
+
+void
+ManageMemoryCache::host_cache_invalidate()
+{
+    host_cache.clear();
+}
+
+void
+ManageMemoryCache::print_host_cache_stats() const
+{
+    std::lock_guard<std::mutex> lock(db_mutex);
+    const int64_t lookups = host_cache_hits + host_cache_misses;
+    std::cout << "Host cache: " << host_cache_hits << " hits of " << lookups << " lookups ("
+        << (lookups ? host_cache_hits * 100 / lookups : 0) << "%), "
+        << host_cache.size() << " entries" << std::endl;
+}
+
 int 
 ManageMemoryCache::sdb_inc_host_stat_(int32_t hostid, int64_t new_age, int32_t ccount_delta, int64_t iostat_delta)
 {
     int rc = DB_NOERROR;
     int32_t ccount;
     int64_t iostat;
-    storage::ittiadb::Table table(db, "hosts");
-    GET_ECODE(rc, table.open("hosts_pkey", storage::ittiadb::Table::Exclusive),
-                           "(inc_host_stat_): FAiled to open hosts table: ");
+    storage::ittiadb::Table& table = hosts_by_id;
     storage::data::SingleRow key(table.columns());
     storage::data::SingleRow data(table.columns());
     key["hostid"].set(hostid);
@@ -421,8 +1510,8 @@ ManageMemoryCache::sdb_inc_host_stat_(int32_t hostid, int64_t new_age, int32_t c
         if (DB_NOERROR == GET_ECODE(rc, table.update_by_index(key, 1, data), 
                             "(inc_host_stat_):Couldn't update hosts.conncount column "))
         {
-            std::cout << " (inc_host_stat_):update hosts.conncount column updated " 
-                << data << std::endl;
+            EXAMPLE_LOG_DEBUG(" (inc_host_stat_):update hosts.conncount column updated " 
+                << data);
         }
     }
 
@@ -435,34 +1524,46 @@ ManageMemoryCache::sdb_remove_old_conns(int count)
     int rc = DB_NOERROR;
     int32_t hostid;
     int64_t iostat;
-    std::cout << "(remove_old_conns): About to delete " << count << "/"
-        << connstat_rows_count << " connstat record(s)" << std::endl;
-    storage::ittiadb::Table table(db, "connstat");
-    GET_ECODE(rc, table.open("cs_by_age"),"(remove_old_conns):Couldn't open table");
+    int64_t max_age = 0;
+    int64_t rows_deleted = 0;
+    EXAMPLE_LOG_DEBUG("(remove_old_conns): About to delete " << count << "/"
+        << connstat_rows_count << " connstat record(s)");
 
-    storage::data::SingleRow first_row(table.columns());
-    for (; count && DB_NOERROR == rc; --count) {
+    storage::data::RowSet<> old_conns;
+    if (DB_NOERROR != (rc = sdb_select_oldest_(
+            "SELECT hostid, iostat, age FROM connstat"
+            " ORDER BY age FETCH FIRST ? ROWS ONLY",
+            count, old_conns, max_age))
+        || old_conns.empty())
+    {
+        return rc;
+    }
 
-        if(DB_NOERROR == GET_ECODE(rc, table.fetch(first_row),
-            "(remove_old_conns):Couldn't fetch row from table"))
-        {
-            first_row["hostid"].get(hostid);
-            first_row["iostat"].get(iostat);
-            // Decrement summary statistics of host who owns this connection
-            rc = sdb_inc_host_stat_(hostid, -1, -1, -iostat);
-
-            if ((DB_NOERROR == rc)
-                && (DB_NOERROR == GET_ECODE(rc, table.delete_by_index(first_row,1),
-                "(remove_old_conns):Couldn't remove record(s) from connstat table ")))
-            {
-                connstat_rows_count--;
-            }
-            else
-            {
-                std::cerr << "(remove_old_conns):Couldn't Decrement summary statistics "
-                          << "of host who owns this connection " << std::endl;
-            }
-        }
+    // Sum up what each host loses, so every host is updated once, in key order
+    host_stat_deltas_t deltas;
+    storage::data::RowSet<>::const_iterator iter = old_conns.begin();
+    for (; iter != old_conns.end(); ++iter) {
+        (*iter)["hostid"].get(hostid);
+        (*iter)["iostat"].get(iostat);
+        host_stat_delta_t& delta = deltas[hostid];
+        delta.conncount -= 1;
+        delta.iostat -= iostat;
+    }
+
+    if (DB_NOERROR == (rc = sdb_delete_up_to_age_("DELETE FROM connstat WHERE age <= ?", max_age, rows_deleted)))
+    {
+        connstat_rows_count -= (int)rows_deleted;
+    }
+
+    // Decrement summary statistics of hosts who owned these connections
+    host_stat_deltas_t::const_iterator delta = deltas.begin();
+    for (; delta != deltas.end() && DB_NOERROR == rc; ++delta) {
+        rc = sdb_inc_host_stat_(delta->first, -1, delta->second.conncount, delta->second.iostat);
+    }
+    if (DB_NOERROR != rc)
+    {
+        EXAMPLE_LOG_ERROR("(remove_old_conns):Couldn't Decrement summary statistics "
+                  << "of hosts who owned removed connections ");
     }
 
     return rc;
@@ -475,12 +1576,17 @@ ManageMemoryCache::sdb_inc_conn_stat(int32_t hostid, const io_stat_row_t &stat)
     db_result_t db_rc = DB_OK;
     int64_t iostat = 0;
     int64_t age = 0;
+    int64_t conn_age = 0;
     io_stat_row_t stat_ = stat;
     int is_new_conn = 0;
 
-    storage::ittiadb::Table table(db, "connstat");
-    GET_ECODE(rc, table.open("cs_pkey", storage::ittiadb::Table::Exclusive), 
-        "(inc_conn_stat): Couldn't open connstat table");
+    // Every insert or update of a connection takes a new age
+    if (DB_NOERROR != (rc = age_seq.next_value(conn_age))) {
+        EXAMPLE_LOG_ERROR("(inc_conn_stat): Couldn't get next value of age_seq: " << rc);
+        return rc;
+    }
+
+    storage::ittiadb::Table& table = conns_by_key;
     storage::data::SingleRow key(table.columns());
     key["hostid"].set(hostid);
     key["dport"].set(stat.dport);
@@ -490,72 +1596,61 @@ ManageMemoryCache::sdb_inc_conn_stat(int32_t hostid, const io_stat_row_t &stat)
     GET_ECODE(rc, db_rc);
     if (DB_NOERROR == rc)
     {
-        //Update Row
-        storage::ittiadb::Query update(db, 
-            " UPDATE connstat "
-            " SET age = NEXT VALUE FOR age_seq,"
-            " iostat = iostat + ?"
-            " WHERE hostid =? AND dport =? AND sport =? "
-            );
-        if( DB_NOERROR == GET_ECODE(rc,update.prepare(),
-            "(inc_conn_stat): Query Update connstat row prepare failed "))
+        //Update Row, with the statement prepared by sdb_open_tables_
+        storage::ittiadb::Query& update = update_conn;
+        storage::data::SingleRow param_row(update.parameters());
+        param_row[0].set(conn_age); //age
+        param_row[1].set(stat.io_bytes); //iostat
+        param_row[2].set(hostid);//hostid
+        param_row[3].set(stat.dport);//sport
+        param_row[4].set(stat.sport);//iostat
+        int64_t rows_affected = update.execute_with(param_row);
+        if (1 != rows_affected)
         {
-            storage::data::SingleRow param_row(update.parameters());
-            param_row[0].set(stat.io_bytes); //iostat
-            param_row[1].set(hostid);//hostid
-            param_row[2].set(stat.dport);//sport
-            param_row[3].set(stat.sport);//iostat
-            int64_t rows_affected = update.execute_with(param_row);
-            if (1 != rows_affected)
-            {
-                const storage::data::Error& error = storage::data::Environment::error();
-                std::cerr << "(inc_conn_stat):Couldn't update connstat table record. [" 
-                    << param_row << "] "
-                    << error << std::endl;
-                rc = error.code;
-            }
+            const storage::data::Error& error = storage::data::Environment::error();
+            EXAMPLE_LOG_ERROR("(inc_conn_stat):Couldn't update connstat table record. [" 
+                << param_row << "] "
+                << error);
+            rc = error.code;
         }
     }
     else if (DB_ENOTFOUND == rc)
     {
             // Not found. Inserting...
-            if (CONNS_DB_LIMIT > connstat_rows_count
-                || DB_NOERROR == (rc = sdb_remove_old_conns(OLD_CONNS_REMOVE_CHUNK))
-                )
+            rc = DB_NOERROR;
+            //The evictor has fallen behind: make room before inserting
+            if (HARD_LIMIT_PCT <= storage_used_pct_()) {
+                ++inline_evictions;
+                rc = sdb_remove_old_conns(OLD_CONNS_REMOVE_CHUNK);
+            }
+            if (DB_NOERROR == rc)
             {
-                rc = DB_NOERROR;
-                storage::ittiadb::Query insert(db, 
-                    "INSERT INTO " 
-                    "connstat(hostid, dport, sport, iostat,age) " 
-                    "VALUES(?,?,?,?,NEXT VALUE FOR age_seq)"
-                    );
-                if (DB_NOERROR == GET_ECODE(rc, insert.prepare(), 
-                    "(inc_conn_stat): Query Insert connstat row prepare failed "))
+                // Prepared once by sdb_open_tables_
+                storage::ittiadb::Query& insert = insert_conn;
+                storage::data::SingleRow param_row(insert.parameters());
+                param_row[0].set(hostid); //hostid
+                param_row[1].set(stat.dport);//dport
+                param_row[2].set(stat.sport);//sport
+                param_row[3].set(stat.io_bytes);//iostat
+                param_row[4].set(conn_age);//age
+                int64_t rows_affected = insert.execute_with(param_row);
+                if (1 != rows_affected)
                 {
-                    storage::data::SingleRow param_row(insert.parameters());
-                    param_row[0].set(hostid); //hostid
-                    param_row[1].set(stat.dport);//dport
-                    param_row[2].set(stat.sport);//sport
-                    param_row[3].set(stat.io_bytes);//iostat
-                    int64_t rows_affected = insert.execute_with(param_row);
-                    if (1 != rows_affected)
-                    {
-                        const storage::data::Error& error = storage::data::Environment::error();
-                        std::cerr << "(inc_conn_stat):Couldn't insert connstat table record. [" << param_row << "] "
-                            << error << std::endl;
-                        rc = error.code;
-                    }
-                    else {
-                        is_new_conn = 1;
-                        connstat_rows_count++;
-                    }
-                    std::cout << "(inc_conn_stat): Add Conn_" << connstat_rows_count 
-                        << "(hostid,dport,sport,iostat)" << param_row << std::endl;
+                    const storage::data::Error& error = storage::data::Environment::error();
+                    EXAMPLE_LOG_ERROR("(inc_conn_stat):Couldn't insert connstat table record. [" << param_row << "] "
+                        << error);
+                    rc = error.code;
+                }
+                else {
+                    is_new_conn = 1;
+                    connstat_rows_count++;
                 }
+                EXAMPLE_LOG_DEBUG("(inc_conn_stat): Add Conn_" << connstat_rows_count 
+                    << "(hostid,dport,sport,iostat)" << param_row);
             }
             else
             {
-                std::cerr << "(inc_conn_stat):Couldn't search connstat table record." << std::endl;
+                EXAMPLE_LOG_ERROR("(inc_conn_stat):Couldn't search connstat table record.");
             }
     }
     // Dont forget to increment summary statistics we collect in 'hosts' table
@@ -564,24 +1659,22 @@ ManageMemoryCache::sdb_inc_conn_stat(int32_t hostid, const io_stat_row_t &stat)
     }
 
     if(DB_NOERROR != rc) {
-        std::cerr << "(inc_conn_stat):Couldn't increment hosts.conncount column." << std::endl;
+        EXAMPLE_LOG_ERROR("(inc_conn_stat):Couldn't increment hosts.conncount column.");
     }
     return rc;
 }
 
 
-int  
-ManageMemoryCache::sdb_inc_io_stat(const io_stat_row_t& io_stat)
+int
+ManageMemoryCache::sdb_apply_io_stat_(const io_stat_row_t& io_stat)
 {
     int rc = DB_NOERROR;
-    db_result_t db_rc = DB_OK;
     int32_t hostid = 0;
-    int tries = 3;
 
-    int save_hosts_rows_count = hosts_rows_count;
-    int save_connstat_rows_count = connstat_rows_count;
-    storage::ittiadb::Transaction txn(db);
-    GET_ECODE(rc,txn.begin(),"Couldn't begin Transaction: ");
+    if (DB_NOERROR != (rc = sdb_open_tables_())) {
+        return rc;
+    }
+
     // Find hostid for given host IP
     rc = sdb_find_host_by_ip(io_stat.hostip, hostid);
     if (rc == DB_ENOTFOUND)
@@ -593,6 +1686,22 @@ ManageMemoryCache::sdb_inc_io_stat(const io_stat_row_t& io_stat)
         // Increment connection statistics
         rc = sdb_inc_conn_stat(hostid, io_stat);
     }
+    return rc;
+}
+
+int  
+ManageMemoryCache::sdb_inc_io_stat(const io_stat_row_t& io_stat)
+{
+    int rc = DB_NOERROR;
+    std::lock_guard<std::mutex> lock(db_mutex);
+
+    int save_hosts_rows_count = hosts_rows_count;
+    int save_connstat_rows_count = connstat_rows_count;
+    storage::ittiadb::Transaction txn(db);
+    GET_ECODE(rc,txn.begin(),"Couldn't begin Transaction: ");
+    if (DB_NOERROR == rc) {
+        rc = sdb_apply_io_stat_(io_stat);
+    }
 
     if (DB_NOERROR == rc) {
         GET_ECODE(rc, txn.commit(),"Couldn't commit transaction: ");
@@ -600,15 +1709,101 @@ ManageMemoryCache::sdb_inc_io_stat(const io_stat_row_t& io_stat)
     // Rollback transaction as error occured
     if (DB_NOERROR != rc)
     {
-        txn.rollback(storage::ittiadb::Transaction::ForcedCompletion); //what is DB_FORCED_COMPLETION?
-        hosts_rows_count = save_hosts_rows_count;
-        connstat_rows_count = save_connstat_rows_count;
-        std::cout << "(inc_io_stat):rollback ..." << std::endl;
+        sdb_rollback_(txn, rc, save_hosts_rows_count, save_connstat_rows_count);
+        EXAMPLE_LOG_WARN("(inc_io_stat):rollback ...");
     }
-    if (DB_ENOPAGESPACE == rc || DB_ENOMEM == rc) {
+    else if (storage_used_pct_() >= HIGH_WATERMARK_PCT) {
+        if (NULL != evictor) {
+            evictor_wakeup.set();
+        }
+        else {
+            rc = sdb_evict_(LOW_WATERMARK_PCT);
+        }
+    }
+    return rc;
+}
+
+int
+ManageMemoryCache::sdb_collect_io_stat(const io_stat_row_t& io_stat)
+{
+    io_stat_key_t key;
+    key.hostip = io_stat.hostip;
+    key.dport = io_stat.dport;
+    key.sport = io_stat.sport;
+    std::lock_guard<std::mutex> lock(db_mutex);
+    pending_io_stats[key] += io_stat.io_bytes;
+    ++pending_samples;
+
+    if (pending_samples >= FLUSH_SAMPLES
+        || std::chrono::steady_clock::now() - last_flush >= std::chrono::milliseconds(FLUSH_INTERVAL_MS))
+    {
+        return sdb_flush_io_stats_();
+    }
+    return DB_NOERROR;
+}
+
+int
+ManageMemoryCache::sdb_flush_io_stats()
+{
+    std::lock_guard<std::mutex> lock(db_mutex);
+    return sdb_flush_io_stats_();
+}
+
+int
+ManageMemoryCache::sdb_flush_io_stats_(bool retry_when_full)
+{
+    int rc = DB_NOERROR;
+
+    last_flush = std::chrono::steady_clock::now();
+    if (pending_io_stats.empty()) {
+        return rc;
+    }
+
+    int save_hosts_rows_count = hosts_rows_count;
+    int save_connstat_rows_count = connstat_rows_count;
+    storage::ittiadb::Transaction txn(db);
+    GET_ECODE(rc, txn.begin(), "(flush_io_stats):Couldn't begin Transaction: ");
+
+    // Apply one merged delta per connection
+    io_stat_buffer_t::const_iterator iter = pending_io_stats.begin();
+    for (; iter != pending_io_stats.end() && DB_NOERROR == rc; ++iter) {
+        io_stat_row_t io_stat;
+        strncpy(io_stat.hostip, iter->first.hostip.c_str(), MAX_IP_LEN - 1);
+        io_stat.hostip[MAX_IP_LEN - 1] = 0;
+        io_stat.dport = iter->first.dport;
+        io_stat.sport = iter->first.sport;
+        io_stat.io_bytes = iter->second;
+        rc = sdb_apply_io_stat_(io_stat);
+    }
+
+    if (DB_NOERROR == rc) {
+        GET_ECODE(rc, txn.commit(), "(flush_io_stats):Couldn't commit transaction: ");
+    }
+    if (DB_NOERROR == rc) {
+        EXAMPLE_LOG_DEBUG("(flush_io_stats): " << pending_samples << " samples merged into "
+            << pending_io_stats.size() << " updates");
+        pending_io_stats.clear();
+        pending_samples = 0;
+    }
+    else {
+        // Keep buffered samples so they can be written again
+        sdb_rollback_(txn, rc, save_hosts_rows_count, save_connstat_rows_count);
+        EXAMPLE_LOG_WARN("(flush_io_stats):rollback ...");
 
-        std::cerr << "(inc_io_stat):No memory left. Consider to lower value of HOSTS_DB_LIMIT/CONNSTAT_DB_LIMIT macro" << std::endl
-            << "  or reserve more mem for ITTIA DB storage (memory_page_size/memory_storage_size)" << std::endl;
+        if (retry_when_full && (DB_ENOPAGESPACE == rc || DB_ENOMEM == rc)
+            && DB_NOERROR == (rc = sdb_evict_(LOW_WATERMARK_PCT)))
+        {
+            // Usage estimate was corrected; retry once with the space freed
+            return sdb_flush_io_stats_(false);
+        }
+    }
+    if (DB_NOERROR == rc && storage_used_pct_() >= HIGH_WATERMARK_PCT) {
+        if (NULL != evictor) {
+            evictor_wakeup.set();
+        }
+        else {
+            rc = sdb_evict_(LOW_WATERMARK_PCT);
+        }
     }
     return rc;
 }
@@ -644,3 +1839,205 @@ ManageMemoryCache::generate_iostat_row(io_stat_row_t& r, int solt)
 }
 
 
+ShardedMemoryCache::ShardedMemoryCache(const char * database_uri, int shard_count, const row_sizes_t * row_sizes,
+                                       size_t queue_capacity)
+    : shards()
+{
+    if (shard_count < 1) {
+        shard_count = 1;
+    }
+    for (int i = 0; i < shard_count; ++i) {
+        char suffix[16];
+        sprintf(suffix, ".%d", i);
+        shard_t * shard = new shard_t(queue_capacity);
+        shard->database_uri = std::string(database_uri) + suffix;
+        shard->row_sizes = row_sizes;
+        shards.push_back(shard);
+    }
+}
+
+ShardedMemoryCache::~ShardedMemoryCache()
+{
+    (void)stop();
+    for (size_t i = 0; i < shards.size(); ++i) {
+        delete shards[i]->cache;
+        if (NULL != shards[i]->database) {
+            (void)shards[i]->database->close();
+            delete shards[i]->database;
+        }
+        delete shards[i];
+    }
+}
+
+int
+ShardedMemoryCache::start()
+{
+    int rc = DB_NOERROR;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        shards[i]->thread = new example_thread(shard_proc, shards[i]);
+    }
+    for (size_t i = 0; i < shards.size(); ++i) {
+        shards[i]->ready.wait();
+        if (DB_NOERROR == rc) {
+            rc = shards[i]->rc.load();
+        }
+    }
+    return rc;
+}
+
+int
+ShardedMemoryCache::submit(const io_stat_row_t& io_stat)
+{
+    shard_t * shard = shards[std::hash<std::string>()(io_stat.hostip) % shards.size()];
+    int rc = shard->rc.load();
+
+    if (DB_NOERROR == rc && !shard->queue.push(io_stat)) {
+        // Queue is full: wait until the worker makes room
+        ++shard->blocked_producers;
+        do {
+            shard->wakeup.set();
+            (void)shard->space_ready.wait_for_milliseconds(10);
+            rc = shard->rc.load();
+        } while (DB_NOERROR == rc && !shard->queue.push(io_stat));
+        --shard->blocked_producers;
+    }
+    if (shard->queue.size() == 1) {
+        shard->wakeup.set();
+    }
+    return rc;
+}
+
+int
+ShardedMemoryCache::stop()
+{
+    int rc = DB_NOERROR;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (NULL != shards[i]->thread) {
+            shards[i]->stopping.store(true);
+            shards[i]->wakeup.set();
+        }
+    }
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (NULL != shards[i]->thread) {
+            shards[i]->thread->join();
+            delete shards[i]->thread;
+            shards[i]->thread = NULL;
+        }
+        if (DB_NOERROR == rc) {
+            rc = shards[i]->rc.load();
+        }
+    }
+    return rc;
+}
+
+int
+ShardedMemoryCache::read_hosts(std::vector<host_summary_t>& hosts)
+{
+    int rc = DB_NOERROR;
+    for (size_t i = 0; i < shards.size() && DB_NOERROR == rc; ++i) {
+        if (NULL != shards[i]->cache) {
+            rc = shards[i]->cache->sdb_read_hosts(hosts);
+        }
+    }
+    return rc;
+}
+
+void
+ShardedMemoryCache::print_stats() const
+{
+    for (size_t i = 0; i < shards.size(); ++i) {
+        std::cout << "Shard " << i << " (" << shards[i]->database_uri << "): "
+            << shards[i]->samples.load() << " samples" << std::endl;
+        if (NULL != shards[i]->cache) {
+            shards[i]->cache->print_memory_usage();
+        }
+    }
+}
+
+void
+ShardedMemoryCache::shard_proc(void * arg)
+{
+    shard_t * shard = static_cast<shard_t *>(arg);
+    int64_t memory_storage_size = 0;
+
+    shard->database = new storage::ittiadb::Connection(shard->database_uri.c_str());
+    int rc = create_cache_database(*shard->database, memory_storage_size);
+    if (DB_NOERROR == rc) {
+        shard->cache = new ManageMemoryCache(*shard->database, memory_storage_size);
+        if (NULL != shard->row_sizes) {
+            shard->cache->set_row_sizes(*shard->row_sizes);
+        }
+        shard->cache->start_evictor();
+    }
+    shard->rc.store(rc);
+    shard->ready.set();
+
+    while (DB_NOERROR == rc) {
+        io_stat_row_t io_stat;
+        if (shard->queue.pop(io_stat)) {
+            if (shard->blocked_producers.load() > 0) {
+                shard->space_ready.set();
+            }
+            rc = shard->cache->sdb_collect_io_stat(io_stat);
+            ++shard->samples;
+            continue;
+        }
+        // Samples queued before stop() are always written
+        if (shard->stopping.load()) {
+            break;
+        }
+        (void)shard->wakeup.wait_for_milliseconds(10);
+    }
+
+    if (NULL != shard->cache) {
+        if (DB_NOERROR == rc) {
+            rc = shard->cache->sdb_flush_io_stats();
+        }
+        shard->cache->stop_evictor();
+    }
+    shard->rc.store(rc);
+    // Release any producer still waiting for space
+    shard->space_ready.set();
+}
+
+static int
+run_sharded(const char * database_uri, int shard_count, const row_sizes_t * row_sizes)
+{
+    ShardedMemoryCache sharded(database_uri, shard_count, row_sizes);
+    int rc = sharded.start();
+
+    // Generate traffic statistics in this thread, written by the shards
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    int i = 0;
+    io_stat_row_t r;
+    for (i = 0; (i < 50000) && (DB_NOERROR == rc); ++i) {
+        ManageMemoryCache::generate_iostat_row(r, i);
+        rc = sharded.submit(r);
+    }
+    if (DB_NOERROR == rc) {
+        rc = sharded.stop();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    std::vector<host_summary_t> hosts;
+    if (DB_NOERROR == rc) {
+        rc = sharded.read_hosts(hosts);
+    }
+    int64_t iostat = 0;
+    for (size_t h = 0; h < hosts.size(); ++h) {
+        iostat += hosts[h].iostat;
+    }
+
+    example_log_flush();
+    sharded.print_stats();
+    std::cout << i << " samples in " << seconds << " s (" << (seconds > 0 ? i / seconds : 0)
+        << " samples/s) over " << shard_count << " shards; merged view: "
+        << hosts.size() << " hosts, " << iostat << " bytes" << std::endl;
+
+    if (DB_NOERROR != rc)
+    {
+        std::cerr << " Stat collection failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,573 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2016 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+/// @file memory_storage_planner.cpp
+///
+/// Command-line tool that measures how much memory storage a schema needs.
+///
+/// Each table is created alone in a small memory storage database and
+/// filled with synthetic rows until the storage runs out of pages. Filling
+/// two storages of different sizes gives the bytes used per row, apart from
+/// the fixed cost of an empty database. Filling once with and once without
+/// the table's secondary indexes splits that cost between table and indexes.
+///
+/// From the per-row costs and a row-count target for each table, the tool
+/// recommends memory_page_size and memory_storage_size for
+/// Connection::MemoryStorageConfig, with some headroom:
+///
+///     memory_storage_planner_cpp [--schema=FILE] [--headroom=PCT] [--fill=PCT] [database] [table=rows ...]
+///
+///  --schema    File with CREATE TABLE and CREATE INDEX statements separated
+///              by ';'. The default is the schema of memory_storage_capacity.
+///  --headroom  Extra storage on top of the measured need, in percent (25).
+///  --fill      How much of each string column is filled, in percent (100).
+///  database    Name of the scratch memory storage database that is filled,
+///              by default memory_storage_planner.ittiadb.
+///  table=rows  Row-count target of a table. Tables without a target are
+///              measured, but not included in the recommendation.
+///
+/// Integer columns are filled with the row number, so keys stay unique.
+/// Foreign keys are checked against rows of the other table, which are not
+/// there when a table is measured alone, so leave them out of the schema.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "storage/data/environment.h"
+#include "storage/ittiadb/transaction.h"
+#include "storage/ittiadb/connection.h"
+#include "storage/ittiadb/query.h"
+#include "storage/data/single_row.h"
+#include "db_iostream.h"
+#include "example_storage_fill.h"
+
+static const char* EXAMPLE_DATABASE = "memory_storage_planner.ittiadb";
+
+/// Schema of memory_storage_capacity, without the foreign key from
+/// connstat to hosts. The key is checked through cs_pkey and takes no
+/// storage of its own.
+static const char* DEFAULT_SCHEMA =
+    "CREATE TABLE hosts("
+    "hostid sint32 NOT NULL,"
+    "hostip ansistr(16) NOT NULL,"
+    "hostname ansistr(50) NULL,"
+    "iostat sint64 NULL,"
+    "conncount sint32 NOT NULL,"
+    "age sint64 NULL,"
+    "CONSTRAINT hosts_pkey PRIMARY KEY(hostid),"
+    "CONSTRAINT hosts_ip_idx UNIQUE(hostip));"
+    "CREATE INDEX hosts_age_idx ON hosts (age);"
+    "CREATE TABLE connstat("
+    "hostid sint32 NOT NULL,"
+    "dport sint32 NOT NULL,"
+    "sport uint32 NOT NULL,"
+    "iostat uint64 NULL,"
+    "age sint32 NULL,"
+    "CONSTRAINT cs_pkey PRIMARY KEY(hostid, dport, sport));"
+    "CREATE INDEX cs_by_age ON connstat (age)";
+
+/// Row-count targets used with the default schema: the host cache of
+/// memory_storage_capacity, with four connections per host.
+static const char* DEFAULT_TARGETS[] = { "hosts=1000", "connstat=4000" };
+
+/// Page sizes tried; the one that needs the least storage is recommended.
+static const int64_t PAGE_SIZES[] = { DB_DEF_PAGE_SIZE, DB_DEF_PAGE_SIZE * 2, DB_DEF_PAGE_SIZE * 4 };
+/// Pages in the smaller of the two storages filled per measurement. The
+/// larger one has twice as many.
+static const int64_t MEASURE_PAGES = 64;
+
+typedef enum {
+    COL_INT8,
+    COL_INT16,
+    COL_INT,
+    COL_FLOAT,
+    COL_STRING,
+    COL_OTHER
+} column_kind_t;
+
+/// Column of a table in the schema, as far as needed to make up values.
+struct column_spec_t
+{
+    std::string name;
+    column_kind_t kind;
+    int size;       ///< Declared length of a string column
+    bool nullable;
+};
+
+/// Table of the schema with the statements that create it.
+struct table_spec_t
+{
+    std::string name;
+    std::string create_sql;
+    std::vector<std::string> index_sql;
+    std::vector<column_spec_t> columns;
+    std::string insert_sql;
+    int64_t target_rows;    ///< -1 if not part of the recommendation
+};
+
+/// Storage used by one table at one page size.
+struct table_cost_t
+{
+    double table_bytes_per_row;
+    double index_bytes_per_row;
+    int64_t fixed_bytes;    ///< Empty database with the table and its indexes
+};
+
+static std::string to_lower(const std::string& s)
+{
+    std::string result(s);
+    for (size_t i = 0; i < result.size(); ++i) {
+        result[i] = (char)tolower((unsigned char)result[i]);
+    }
+    return result;
+}
+
+static std::string trim(const std::string& s)
+{
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return std::string::npos == begin ? std::string() : s.substr(begin, end - begin + 1);
+}
+
+/// Split @a text at @a separator, except inside parentheses.
+static std::vector<std::string> split_top_level(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    std::string part;
+    int depth = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        depth += ('(' == c) - (')' == c);
+        if (separator == c && depth == 0) {
+            parts.push_back(trim(part));
+            part.clear();
+        }
+        else {
+            part += c;
+        }
+    }
+    parts.push_back(trim(part));
+    return parts;
+}
+
+static std::vector<std::string> split_words(const std::string& text)
+{
+    std::vector<std::string> words;
+    std::istringstream in(text);
+    std::string word;
+    while (in >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+/// Parse one column definition such as "hostip ansistr(16) NOT NULL".
+/// Returns false for table constraints.
+static bool parse_column(const std::string& definition, column_spec_t& column)
+{
+    std::vector<std::string> words = split_words(definition);
+    if (words.size() < 2) {
+        return false;
+    }
+    std::string first = to_lower(words[0]);
+    if ("constraint" == first || "primary" == first || "unique" == first
+        || "foreign" == first || "check" == first)
+    {
+        return false;
+    }
+
+    std::string type = to_lower(definition.substr(definition.find(words[1], words[0].size())));
+    size_t paren = type.find('(');
+    std::string base = trim(type.substr(0, std::min(paren, type.find(' '))));
+
+    column.name = words[0];
+    column.size = std::string::npos == paren ? 1 : atoi(type.c_str() + paren + 1);
+    column.nullable = std::string::npos == to_lower(definition).find("not null");
+
+    if ("sint8" == base || "uint8" == base) {
+        column.kind = COL_INT8;
+    }
+    else if ("sint16" == base || "uint16" == base || "smallint" == base) {
+        column.kind = COL_INT16;
+    }
+    else if ("sint32" == base || "uint32" == base || "sint64" == base || "uint64" == base
+             || "integer" == base || "int" == base || "bigint" == base)
+    {
+        column.kind = COL_INT;
+    }
+    else if ("float32" == base || "float64" == base || "float" == base
+             || "real" == base || "double" == base)
+    {
+        column.kind = COL_FLOAT;
+    }
+    else if ("ansistr" == base || "utf8str" == base || "utf16str" == base
+             || "varchar" == base || "char" == base || "nvarchar" == base || "nchar" == base)
+    {
+        column.kind = COL_STRING;
+    }
+    else {
+        column.kind = COL_OTHER;
+    }
+    return true;
+}
+
+/// Split the schema into tables and their indexes, and build the
+/// statement that inserts a row into each table.
+static int parse_schema(const std::string& schema, std::vector<table_spec_t>& tables)
+{
+    std::vector<std::string> statements = split_top_level(schema, ';');
+    for (size_t i = 0; i < statements.size(); ++i) {
+        const std::string& sql = statements[i];
+        std::vector<std::string> words = split_words(to_lower(sql));
+        if (words.empty()) {
+            continue;
+        }
+
+        if (words.size() >= 3 && "create" == words[0] && "table" == words[1]) {
+            table_spec_t table;
+            size_t open = sql.find('(');
+            size_t close = sql.rfind(')');
+            if (std::string::npos == open || std::string::npos == close || close < open) {
+                std::cerr << "Can't parse: " << sql << std::endl;
+                return DB_FAILURE;
+            }
+            table.name = split_words(sql)[2];
+            table.name = table.name.substr(0, table.name.find('('));
+            table.create_sql = sql;
+            table.target_rows = -1;
+
+            std::vector<std::string> definitions = split_top_level(sql.substr(open + 1, close - open - 1), ',');
+            std::string names, markers;
+            for (size_t d = 0; d < definitions.size(); ++d) {
+                column_spec_t column;
+                if (!parse_column(definitions[d], column)) {
+                    continue;
+                }
+                if (COL_OTHER == column.kind && !column.nullable) {
+                    std::cerr << "Can't make up values for column " << table.name << "."
+                              << column.name << "; make it NULL or leave it out" << std::endl;
+                    return DB_FAILURE;
+                }
+                if (COL_OTHER != column.kind) {
+                    names += (names.empty() ? "" : ", ") + column.name;
+                    markers += markers.empty() ? "?" : ", ?";
+                    table.columns.push_back(column);
+                }
+            }
+            table.insert_sql = "INSERT INTO " + table.name + " (" + names + ") VALUES (" + markers + ")";
+            tables.push_back(table);
+        }
+        else if (words.size() >= 5 && "create" == words[0]
+                 && ("index" == words[1] || ("unique" == words[1] && "index" == words[2])))
+        {
+            // CREATE [UNIQUE] INDEX name ON table ...
+            size_t on = 0;
+            while (on < words.size() && "on" != words[on]) {
+                ++on;
+            }
+            std::string table_name = on + 1 < words.size() ? words[on + 1] : std::string();
+            table_name = table_name.substr(0, table_name.find('('));
+            bool found = false;
+            for (size_t t = 0; t < tables.size() && !found; ++t) {
+                if (to_lower(tables[t].name) == table_name) {
+                    tables[t].index_sql.push_back(sql);
+                    found = true;
+                }
+            }
+            if (!found) {
+                std::cerr << "Index on unknown table: " << sql << std::endl;
+                return DB_FAILURE;
+            }
+        }
+        else {
+            std::cerr << "Ignoring statement: " << sql << std::endl;
+        }
+    }
+    return tables.empty() ? DB_FAILURE : DB_NOERROR;
+}
+
+/// Set the insert parameters for row number @a row_number.
+static void set_row_values(const table_spec_t& table, int64_t row_number, int fill_pct,
+                           storage::data::Row& params)
+{
+    for (size_t c = 0; c < table.columns.size(); ++c) {
+        const column_spec_t& column = table.columns[c];
+        switch (column.kind) {
+        case COL_INT8:
+            params[(int)c].set(row_number % 100);
+            break;
+        case COL_INT16:
+            params[(int)c].set(row_number % 30000);
+            break;
+        case COL_INT:
+            params[(int)c].set(row_number);
+            break;
+        case COL_FLOAT:
+            params[(int)c].set((double)row_number);
+            break;
+        case COL_STRING:
+        {
+            // Zero-padded row number, so the string is unique while it is
+            // long enough to hold all digits
+            int length = column.size * fill_pct / 100;
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%020lld", (long long)row_number);
+            std::string value(buffer);
+            if (length < (int)value.size()) {
+                value = value.substr(value.size() - (length < 1 ? 1 : length));
+            }
+            else {
+                value.insert(0, length - value.size(), '0');
+            }
+            params[(int)c].set(value);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+/// Fills @a table alone, with or without its secondary indexes.
+class table_filler : public example_storage_filler
+{
+public:
+    table_filler(const table_spec_t& table, bool with_indexes, int fill_pct)
+        : table(table), with_indexes(with_indexes), fill_pct(fill_pct)
+    {
+    }
+
+    int create_schema(storage::ittiadb::Connection& database)
+    {
+        int rc = DB_NOERROR;
+        if (DB_NOERROR != GET_ECODE(rc, storage::ittiadb::Query(database, table.create_sql.c_str()).execute(),
+                                    "Create table failed "))
+        {
+            return rc;
+        }
+        for (size_t i = 0; with_indexes && i < table.index_sql.size(); ++i) {
+            if (DB_NOERROR != GET_ECODE(rc, storage::ittiadb::Query(database, table.index_sql[i].c_str()).execute(),
+                                        "Create index failed "))
+            {
+                return rc;
+            }
+        }
+        return rc;
+    }
+
+    const char * insert_sql() const { return table.insert_sql.c_str(); }
+
+    void set_row(int64_t row_number, storage::data::Row& params)
+    {
+        set_row_values(table, row_number, fill_pct, params);
+    }
+
+private:
+    const table_spec_t& table;
+    const bool with_indexes;
+    const int fill_pct;
+};
+
+/// Bytes per row and fixed bytes of @a table with or without its indexes.
+static int measure_fill(const char* database_uri, const table_spec_t& table, bool with_indexes,
+                        int64_t page_size, int fill_pct, double& bytes_per_row, int64_t& fixed_bytes)
+{
+    table_filler filler(table, with_indexes, fill_pct);
+    int rc = example_measure_row_bytes(database_uri, filler, page_size, MEASURE_PAGES, bytes_per_row, fixed_bytes);
+    if (DB_NOERROR != rc) {
+        std::cerr << "Couldn't measure rows of " << table.name << std::endl;
+    }
+    return rc;
+}
+
+static int measure_table(const char* database_uri, const table_spec_t& table, int64_t page_size, int fill_pct,
+                         table_cost_t& cost)
+{
+    int rc;
+    double table_only = 0;
+    double with_indexes = 0;
+
+    if (DB_NOERROR != (rc = measure_fill(database_uri, table, false, page_size, fill_pct, table_only, cost.fixed_bytes))) {
+        return rc;
+    }
+    with_indexes = table_only;
+    if (!table.index_sql.empty()
+        && DB_NOERROR != (rc = measure_fill(database_uri, table, true, page_size, fill_pct, with_indexes, cost.fixed_bytes)))
+    {
+        return rc;
+    }
+
+    cost.table_bytes_per_row = table_only;
+    cost.index_bytes_per_row = with_indexes > table_only ? with_indexes - table_only : 0;
+    return DB_NOERROR;
+}
+
+static int read_schema_file(const char* path, std::string& schema)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Can't read schema file " << path << std::endl;
+        return DB_FAILURE;
+    }
+    std::ostringstream text;
+    text << in.rdbuf();
+    schema = text.str();
+    return DB_NOERROR;
+}
+
+static void print_usage()
+{
+    std::cerr << "Usage: memory_storage_planner_cpp [--schema=FILE] [--headroom=PCT] [--fill=PCT] [database] [table=rows ...]"
+              << std::endl;
+}
+
+int
+example_main(int argc, char* argv[])
+{
+    const char* database_uri = EXAMPLE_DATABASE;
+    std::string schema = DEFAULT_SCHEMA;
+    bool default_schema = true;
+    int headroom_pct = 25;
+    int fill_pct = 100;
+    std::vector<std::string> targets;
+    std::vector<table_spec_t> tables;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (0 == strncmp(arg, "--schema=", 9)) {
+            if (DB_NOERROR != read_schema_file(arg + 9, schema)) {
+                return EXIT_FAILURE;
+            }
+            default_schema = false;
+        }
+        else if (0 == strncmp(arg, "--headroom=", 11)) {
+            headroom_pct = atoi(arg + 11);
+        }
+        else if (0 == strncmp(arg, "--fill=", 7)) {
+            fill_pct = atoi(arg + 7);
+        }
+        else if (NULL != strchr(arg, '=') && '-' != arg[0]) {
+            targets.push_back(arg);
+        }
+        else if ('-' != arg[0]) {
+            database_uri = arg;
+        }
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (fill_pct < 1 || fill_pct > 100 || headroom_pct < 0) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (targets.empty() && default_schema) {
+        targets.assign(DEFAULT_TARGETS, DEFAULT_TARGETS + sizeof(DEFAULT_TARGETS) / sizeof(DEFAULT_TARGETS[0]));
+    }
+
+    if (DB_NOERROR != parse_schema(schema, tables)) {
+        std::cerr << "No tables to measure" << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < targets.size(); ++i) {
+        std::string name = to_lower(targets[i].substr(0, targets[i].find('=')));
+        int64_t rows = atoll(targets[i].c_str() + targets[i].find('=') + 1);
+        bool found = false;
+        for (size_t t = 0; t < tables.size(); ++t) {
+            if (to_lower(tables[t].name) == name) {
+                tables[t].target_rows = rows;
+                found = true;
+            }
+        }
+        if (!found) {
+            std::cerr << "No table " << name << " in the schema" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    int64_t best_page_size = 0;
+    int64_t best_storage_size = 0;
+    for (size_t p = 0; p < sizeof(PAGE_SIZES) / sizeof(PAGE_SIZES[0]); ++p) {
+        const int64_t page_size = PAGE_SIZES[p];
+        int64_t fixed_bytes = 0;
+        double row_bytes = 0;
+
+        std::cout << "\nmemory_page_size = " << page_size << "\n"
+                  << "  " << std::left << std::setw(20) << "table" << std::right
+                  << " " << std::setw(12) << "target rows"
+                  << " " << std::setw(12) << "table B/row"
+                  << " " << std::setw(12) << "index B/row"
+                  << " " << std::setw(12) << "total B/row"
+                  << " " << std::setw(14) << "bytes needed" << std::endl;
+        for (size_t t = 0; t < tables.size(); ++t) {
+            const table_spec_t& table = tables[t];
+            table_cost_t cost;
+            if (DB_NOERROR != measure_table(database_uri, table, page_size, fill_pct, cost)) {
+                return EXIT_FAILURE;
+            }
+
+            const double per_row = cost.table_bytes_per_row + cost.index_bytes_per_row;
+            const int64_t rows = table.target_rows < 0 ? 0 : table.target_rows;
+            std::cout << "  " << std::left << std::setw(20) << table.name << std::right
+                      << " " << std::setw(12) << (table.target_rows < 0 ? std::string("-") : std::to_string((long long)rows))
+                      << std::fixed << std::setprecision(1)
+                      << " " << std::setw(12) << cost.table_bytes_per_row
+                      << " " << std::setw(12) << cost.index_bytes_per_row
+                      << " " << std::setw(12) << per_row
+                      << " " << std::setw(14) << (int64_t)(per_row * (double)rows) << std::endl;
+
+            // The empty database is paid for once; the largest fixed cost
+            // of any one table stands in for it
+            if (cost.fixed_bytes > fixed_bytes) {
+                fixed_bytes = cost.fixed_bytes;
+            }
+            row_bytes += per_row * (double)rows;
+        }
+
+        const double needed = (double)fixed_bytes + row_bytes;
+        const int64_t pages = (int64_t)(needed * (100 + headroom_pct) / 100 / (double)page_size) + 1;
+        std::cout << "  fixed bytes: " << fixed_bytes << ", with " << headroom_pct << "% headroom: "
+                  << pages << " pages = " << pages * page_size << " bytes" << std::endl;
+
+        if (0 == best_storage_size || pages * page_size < best_storage_size) {
+            best_page_size = page_size;
+            best_storage_size = pages * page_size;
+        }
+    }
+
+    std::cout << "\nRecommended MemoryStorageConfig:\n"
+              << "  memory_page_size    = " << best_page_size << "\n"
+              << "  memory_storage_size = " << best_storage_size
+              << "  (" << best_storage_size / best_page_size << " pages)" << std::endl;
+
+    return EXIT_SUCCESS;
+}
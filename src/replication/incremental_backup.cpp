@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <memory>
 
 #include "storage/ittiadb/connection.h"
 #include "storage/ittiadb/transaction.h"
@@ -35,6 +36,8 @@
 #include "db_iostream.h"
 #include "ittia/os/os_file.h"
 #include "example_thread.h"
+#include "example_thread_pool.h"
+#include "example_log.h"
 
 
 using ::storage::data::Environment;
@@ -56,8 +59,17 @@ static const db_rep_address_t BACKUP_REP_ADDRESS = 2;
 
 /// Configuration for backup example, shared between threads.
 struct example_backup_config_t {
-    /// Set to `true` to enable incremental backup.
-    bool  is_backup_enabled;
+    example_backup_config_t()
+        : main_database_committed(true)
+        , database_name(NULL)
+        , incremental_backup_name(NULL)
+    {
+    }
+
+    /// Signalled to stop insertion and incremental backup.
+    example_event backup_stopped;
+    /// Signalled after each commit to the main database.
+    example_event main_database_committed;
     /// Name of main database file.
     const char * database_name;
     /// Name of backup database file.
@@ -74,8 +86,9 @@ static void main_database_insertion_task(void *argument);        //:params examp
 // Incremental backup functions
 static void full_database_backup_task(void * argument);          //:params example_backup_config_t
 static void incremental_backup_setup(Connection & main_database, Connection & backup_database);
-static void incremental_backup_task(void * argument);            //:params example_backup_config_t
+static void incremental_backup_task(example_backup_config_t * td, Connection& backup_database);
 static void recover_from_backup(example_backup_config_t * td);
+static void stop_background_tasks(example_backup_config_t * td);
 
 
 void
@@ -109,7 +122,7 @@ main_database_insertion_task(void *argument)
 
     Connection main_database(bc->database_name);
     if(DB_OK != main_database.open(Connection::OpenExisting)) {
-        std::cout << "Could not open " << main_database.uri() << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Could not open " << main_database.uri() << ": " << Environment::error());
         exit(1);
     }
 
@@ -125,17 +138,15 @@ main_database_insertion_task(void *argument)
         "  values(?,?)"
         );
     if (DB_OK != insert_query_t1.prepare() || DB_OK != insert_query_t2.prepare()) {
-        std::cout << "Failed preparing parametrized query" << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Failed preparing parametrized query" << ": " << Environment::error());
         exit(1);
     }
     // Both queries share the same parameter types and values
     SingleRow params(insert_query_t1.parameters());
 
     Transaction txn(main_database);
-    while (bc->is_backup_enabled) {
-        // Sleep when transaction is not active
-        example_thread::sleep_for_seconds(1);
-
+    // Wait when transaction is not active, but stop as soon as requested
+    while (!bc->backup_stopped.wait_for_milliseconds(1000)) {
         txn.begin(Transaction::Shared);
         //Insert 3 values each time to check correctness of a back up.
         for(int i = 0; i < 3; i++) {
@@ -144,32 +155,35 @@ main_database_insertion_task(void *argument)
             if (0 > insert_query_t1.execute_with(params)||
                 0 > insert_query_t2.execute_with(params))
             {
-                std::cout << "Insert failed: " << Environment::error() << std::endl;
+                EXAMPLE_LOG_ERROR("Insert failed: " << Environment::error());
                 continue;
             }
         }
         ++bc->insert_transaction_counter;
         txn.commit();
+
+        // Wake the incremental backup task to copy the new transaction.
+        bc->main_database_committed.set();
     }
 }
 
 void
 full_database_backup_task(void *argument)
 {
-    std::cout << "Database backup started" << std::endl;
+    EXAMPLE_LOG_INFO("Database backup started");
     example_backup_config_t *td = static_cast<example_backup_config_t *> (argument);
 
     Connection main_database(td->database_name);
     if (DB_OK != main_database.open(Connection::OpenExisting))
     {
-        std::cout << "Unable to open main database, " << main_database.uri()<< ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to open main database, " << main_database.uri()<< ": " << Environment::error());
         exit(1);
     }
 
     // Copy main database to the backup database file
     if (DB_OK != main_database.backup( td->incremental_backup_name, 0))
     {
-        std::cout << "Unable to create a backup of the main database, " << main_database.uri()<< ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create a backup of the main database, " << main_database.uri()<< ": " << Environment::error());
         exit(1);
     }
 
@@ -177,13 +191,13 @@ full_database_backup_task(void *argument)
     Connection backup_database(td->incremental_backup_name);
     if (DB_OK != backup_database.open(Connection::OpenExisting))
     {
-        std::cout << "Unable to open backup database for incremental backup setup. " << backup_database.uri() << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to open backup database for incremental backup setup. " << backup_database.uri() << ": " << Environment::error());
         exit(1);
     }
-    std::cout << "Full database backup is complete!!!" << std::endl;
+    EXAMPLE_LOG_INFO("Full database backup is complete!!!");
 
     incremental_backup_setup(main_database, backup_database);
-    std::cout << "Database is configured for incremental backup" << std::endl;
+    EXAMPLE_LOG_INFO("Database is configured for incremental backup");
 }
 
 // Configure incremental backup using ITTIA DB SQL replication
@@ -213,36 +227,36 @@ incremental_backup_setup(Connection& main_database, Connection& backup_database)
         main_database.uri());
     if (DB_OK != backup_catalog.create_peer( PEER_NAME, backup_definition))
     {
-        std::cout << "Unable to create incremental backup: " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create incremental backup: " << Environment::error());
         exit(1);
     }
 }
 
 // Perform incremental backup in a continuous loop.
-// Use ITTIA DB SQL ad hoc database replication. Note: with this approach, the backup is run every
-// 100 milliseconds, so some data loss may occur if the main database is damaged or destroyed.
+// Use ITTIA DB SQL ad hoc database replication. Note: with this approach, the backup is run after
+// each commit to the main database, so some data loss may occur if the main database is damaged
+// or destroyed before the exchange completes.
 // Use synchronous replication instead if no data loss is acceptable.
 //
 // Database back up is intentionally not synchronized with database updates to demonstrate the
 // possibility of losing some data; this thread finishes before main thread stops updating.
+//
+// Runs on a pool worker that has already opened its own connection to the backup database.
 void
-incremental_backup_task(void *argument)
+incremental_backup_task(example_backup_config_t * td, Connection& backup_database)
 {
-    example_backup_config_t * td = static_cast<example_backup_config_t *> (argument);
-    std::cout<<"Incremental backup task started"<<std::endl;
-    Connection backup_database(td->incremental_backup_name);
-    if(DB_OK != backup_database.open(Connection::OpenExisting)) {
-        std::cout << "Could not open " << backup_database.uri() << ": " << Environment::error() << std::endl;
-        return;
-    }
-
+    EXAMPLE_LOG_INFO("Incremental backup task started");
     ReplicationPeer backup_peer(backup_database, PEER_NAME);
-    while(td->is_backup_enabled)
+    for (;;)
     {
-        example_thread::sleep_for_milliseconds(100);
+        // Wait for a new commit to the main database or a stop request.
+        td->main_database_committed.wait();
+        if (td->backup_stopped.is_set()) {
+            break;
+        }
         if (DB_OK != backup_peer.exchange())
         {
-            std::cout << "Unable to connect and update backup: " << Environment::error() << std::endl;
+            EXAMPLE_LOG_ERROR("Unable to connect and update backup: " << Environment::error());
         }
     }
 }
@@ -253,12 +267,12 @@ incremental_backup_task(void *argument)
 void
 recover_from_backup(example_backup_config_t * td)
 {
-    std::cout<<"Restoring from back up."<<std::endl;
+    EXAMPLE_LOG_INFO("Restoring from back up.");
     Connection backup_database(td->incremental_backup_name);
 
     if (DB_OK != backup_database.open(Connection::OpenExisting))
     {
-        std::cout << "Unable to open backup database" << backup_database.uri() << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to open backup database" << backup_database.uri() << ": " << Environment::error());
         exit(1);
     }
 
@@ -266,19 +280,19 @@ recover_from_backup(example_backup_config_t * td)
     // Remove peer referencing the original main database, which no longer exists.
     ReplicationCatalog backup_database_catalog(backup_database);
     if (DB_OK != backup_database_catalog.drop_peer(PEER_NAME)) {
-        std::cout << "Failed to reset outdated backup settings" << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Failed to reset outdated backup settings" << ": " << Environment::error());
         exit(1);
     }
 
     if (backup_database.backup(td->database_name, 0) != DB_OK) {
-        std::cout << "Failed to restore database from backup," << backup_database.uri() << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Failed to restore database from backup," << backup_database.uri() << ": " << Environment::error());
         exit(1);
     }
 
     // The newly created main database must exist after backup function call.
     Connection main_recovered(td->database_name);
     main_recovered.open(Connection::OpenExisting);
-    std::cout<<"Main database recovered from the most recent incremental backup."<<std::endl;
+    EXAMPLE_LOG_INFO("Main database recovered from the most recent incremental backup.");
 
     // Set new configurations for incremental backup.
     incremental_backup_setup(main_recovered, backup_database);
@@ -290,12 +304,19 @@ recover_from_backup(example_backup_config_t * td)
     (void)main_database_catalog.table_set("t2", main_table_info);
 }
 
+// Ask background tasks to stop and wake them immediately.
+void
+stop_background_tasks(example_backup_config_t * td)
+{
+    td->backup_stopped.set();
+    td->main_database_committed.set();
+}
+
 
 int
 example_main(int argc, char *argv[])
 {
     struct example_backup_config_t td;
-    td.is_backup_enabled = true;
     td.database_name = MAIN_FILE_NAME;
     td.incremental_backup_name = BACKUP_FILE_NAME;
     if (argc > 1) {
@@ -310,7 +331,7 @@ example_main(int argc, char *argv[])
     Connection main_database(td.database_name);
     if (DB_OK != main_database.open(Connection::CreateAlways))
     {
-        std::cout << "Unable to create database" << td.database_name << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create database" << td.database_name << ": " << Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -318,43 +339,58 @@ example_main(int argc, char *argv[])
     initialize_database(main_database);
     main_database.close();
 
+    // Run all background tasks on a shared pool of two worker threads
+    // instead of spawning a new thread for each task.
+    example_thread_pool background_tasks(2);
+
     // Continuously insert into the main database in a background thread.
-    example_thread main_database_insert_thread(main_database_insertion_task, &td);
+    std::future<void> main_database_insert = background_tasks.submit(main_database_insertion_task, &td);
 
     // Perform a full backup and configure incremental backup in a background thread.
-    example_thread backup_thread(full_database_backup_task, &td);
-    backup_thread.join();
+    background_tasks.submit(full_database_backup_task, &td).wait();
 
-    // Begin incremental backup in a background thread.
-    example_thread incremental_backup_thread(incremental_backup_task, &td);
+    // Begin incremental backup on a worker that opens its own connection to
+    // the backup database and keeps it for every exchange. If the backup
+    // can't be opened, the task is dropped and its future is ready at once.
+    std::unique_ptr<example_thread_pool> backup_exchange(
+        new example_thread_pool(1, td.incremental_backup_name));
+    std::future<void> incremental_backup = backup_exchange->submit(
+        [&td](Connection& backup_database) { incremental_backup_task(&td, backup_database); });
 
     // Continue adding new records with incremental backup for 4 seconds.
     example_thread::sleep_for_seconds(4);
 
-    // Close all connections and wait for all background threads to finish.
-    td.is_backup_enabled = false;
-    incremental_backup_thread.join();
-    main_database_insert_thread.join();
+    // Close all connections and wait for all background tasks to finish.
+    stop_background_tasks(&td);
+    incremental_backup.wait();
+    main_database_insert.wait();
+
+    // Close the worker's backup connection before the backup is restored.
+    backup_exchange->shutdown();
 
     // Simulate hardware failure by removing the main database.
     main_database.remove();
 
     // Recover the main database from the backup file.
     recover_from_backup(&td);
-    std::cout << "Back to normal after failure." << std::endl;
-    td.is_backup_enabled = true;
+    EXAMPLE_LOG_INFO("Back to normal after failure.");
+    td.backup_stopped.reset();
+    td.main_database_committed.reset();
 
-    // Start tasks to insert new data and resume incremental backup.
-    example_thread main_database_recovered_insert_thread(main_database_insertion_task, &td);
-    example_thread incremental_backup_recovered(incremental_backup_task, &td);
+    // Start tasks to insert new data, reusing the same worker threads, and
+    // resume incremental backup on a new connection to the backup.
+    main_database_insert = background_tasks.submit(main_database_insertion_task, &td);
+    backup_exchange.reset(new example_thread_pool(1, td.incremental_backup_name));
+    incremental_backup = backup_exchange->submit(
+        [&td](Connection& backup_database) { incremental_backup_task(&td, backup_database); });
 
     // Continue adding new records with incremental backup for 5 seconds.
     example_thread::sleep_for_seconds(5);
 
-    // Close all connections and wait for all background threads to finish.
-    td.is_backup_enabled = false;
-    main_database_recovered_insert_thread.join();
-    incremental_backup_recovered.join();
+    // Close all connections and wait for all background tasks to finish.
+    stop_background_tasks(&td);
+    main_database_insert.wait();
+    incremental_backup.wait();
 
     return 0;
 }
@@ -35,6 +35,7 @@
 #include "storage/data/row_set.h"
 #include "storage/types/character_varying.h"
 #include "db_iostream.h"
+#include "example_log.h"
 
 using ::storage::data::Environment;
 using ::storage::ittiadb::Connection;
@@ -127,6 +128,7 @@ print_database(const char * dbname, Connection& database)
     (void)Query(database, "select * from t1").execute(result_t1);
     (void)Query(database, "select * from t2").execute(result_t2);
     (void)txn.commit();
+    example_log_flush();
     std::cout << "# " << dbname << std::endl;
     std::cout << "## t1" << std::endl;
     std::cout << result_t1.columns() << std::endl;
@@ -154,7 +156,7 @@ example_main(int argc, char *argv[])
     Connection main_database(main_file_name);
     if (DB_OK != main_database.open(Connection::CreateAlways))
     {
-        std::cerr << "Unable to create database" << main_file_name << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create database" << main_file_name << ": " << Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -166,7 +168,7 @@ example_main(int argc, char *argv[])
     Connection mirror_database(mirror_file_name);
     if (DB_OK != mirror_database.open(Connection::CreateAlways))
     {
-        std::cerr << "Unable to create database" << mirror_file_name << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create database" << mirror_file_name << ": " << Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -181,13 +183,13 @@ example_main(int argc, char *argv[])
                 main_file_name);
     if (DB_OK != rep_catalog.create_peer(peer_name, peer_definition))
     {
-        std::cerr << "Unable to create peer: " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create peer: " << Environment::error());
         return EXIT_FAILURE;
     }
     ReplicationPeer peer(mirror_database, peer_name);
     if (DB_OK != peer.exchange())
     {
-        std::cerr << "Unable to connect to peer: " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to connect to peer: " << Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -202,7 +204,7 @@ example_main(int argc, char *argv[])
         CharacterVarying<DB_MAX_TABLE_NAME> table_name;
         iter->at(0).get(table_name);
         if (DB_OK != peer.snapshot_in(*table_name)) {
-            std::cerr << "Error copying table " << *table_name << " from peer: " << Environment::error().description << std::endl;
+            EXAMPLE_LOG_ERROR("Error copying table " << *table_name << " from peer: " << Environment::error().description);
         }
     }
 
@@ -212,11 +214,11 @@ example_main(int argc, char *argv[])
     while (true) {
         if (DB_OK != peer.exchange())
         {
-            std::cerr << "Unable to connect to peer: " << Environment::error() << std::endl;
+            EXAMPLE_LOG_ERROR("Unable to connect to peer: " << Environment::error());
             return EXIT_FAILURE;
         }
         else {
-            std::cout << "Replication exchange complete" << std::endl;
+            EXAMPLE_LOG_INFO("Replication exchange complete");
         }
 
         // Show contents of each database after replication exchange
@@ -224,6 +226,7 @@ example_main(int argc, char *argv[])
         print_database("mirror database", mirror_database);
 
         // Prompt for changes to the main database
+        example_log_flush();
         std::cout << "Enter SQL statements or an empty line to replicate changes to the mirror" << std::endl;
         sql_line_shell(main_database);
     }
@@ -33,6 +33,7 @@
 #include "storage/data/row_set.h"
 #include "storage/types/character_varying.h"
 #include "db_iostream.h"
+#include "example_log.h"
 
 using ::storage::data::Environment;
 using ::storage::ittiadb::Connection;
@@ -101,6 +102,7 @@ print_database(const char * dbname, Connection& connection)
     RowSet<> result_t2;
     (void)Query(connection, "select * from t1").execute(result_t1);
     (void)Query(connection, "select * from t2").execute(result_t2);
+    example_log_flush();
     std::cout << "# " << dbname << std::endl;
     std::cout << "## t1" << std::endl << result_t1 << std::endl;
     std::cout << "## t2" << std::endl << result_t2 << std::endl;
@@ -110,6 +112,7 @@ void
 sql_line_shell(Connection& database)
 {
     // Execute a SQL query for each line of input.
+    example_log_flush();
     std::cout << "Enter SQL statements or an empty line to quit" << std::endl;
 
     while (std::cin.good()) {
@@ -160,7 +163,7 @@ example_main(int argc, char *argv[])
     Connection main_database(database_file_name);
     if (DB_OK != main_database.open(Connection::CreateAlways))
     {
-        std::cerr << "Unable to create database" << database_file_name << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create database" << database_file_name << ": " << Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -177,7 +180,7 @@ example_main(int argc, char *argv[])
     Connection mirror_database(mirror_file_name);
     if (DB_OK != mirror_database.open(Connection::CreateAlways))
     {
-        std::cerr << "Unable to create database" << mirror_file_name << ": " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create database" << mirror_file_name << ": " << Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -190,14 +193,14 @@ example_main(int argc, char *argv[])
                 database_file_name);
     if (DB_OK != mirror_rep_catalog.create_peer(peer_name, peer_definition))
     {
-        std::cerr << "Unable to create peer: " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to create peer: " << Environment::error());
         return EXIT_FAILURE;
     }
 
     ReplicationPeer peer(mirror_database, peer_name);
     if (DB_OK != peer.exchange())
     {
-        std::cerr << "Unable to connect to peer: " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to connect to peer: " << Environment::error());
         return EXIT_FAILURE;
     }
 
@@ -246,7 +249,7 @@ example_main(int argc, char *argv[])
             CharacterVarying<DB_MAX_TABLE_NAME> table_name;
             iter->at(0).get(table_name);
             if (DB_OK != peer.snapshot_in(*table_name)) {
-                std::cerr << "Error copying table " << *table_name << " from peer: " << Environment::error().description << std::endl;
+                EXAMPLE_LOG_ERROR("Error copying table " << *table_name << " from peer: " << Environment::error().description);
             }
         }
     }
@@ -255,7 +258,7 @@ example_main(int argc, char *argv[])
 
     if (DB_OK != peer.exchange())
     {
-        std::cerr << "Unable to connect to peer: " << Environment::error() << std::endl;
+        EXAMPLE_LOG_ERROR("Unable to connect to peer: " << Environment::error());
         return EXIT_FAILURE;
     }
 